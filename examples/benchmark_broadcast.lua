@@ -0,0 +1,52 @@
+local shaco = require "shaco"
+
+-- broadcast a 4k message to many agents, send one by one vs shared payload
+-- usage: --start "benchmark_broadcast [agents] [times]"
+local agents, times = ...
+
+if agents == 'agent' then
+    shaco.start(function()
+        local count = 0
+        shaco.dispatch('um', function(source, session, data)
+            count = count + 1
+        end)
+        shaco.dispatch('lua', function(source, session, cmd)
+            shaco.ret(shaco.pack(count))
+            count = 0
+        end)
+    end)
+    return
+end
+
+local data = string.rep("x", 4096)
+
+local function wait(handles, times)
+    for _, h in ipairs(handles) do
+        assert(shaco.call(h, 'lua', 'count') == times)
+    end
+end
+
+shaco.start(function()
+    agents = tonumber(agents) or 200
+    times = tonumber(times) or 100
+    local handles = {}
+    for i=1,agents do
+        handles[i] = assert(shaco.newservice('benchmark_broadcast agent'))
+    end
+    local t1 = shaco.now()
+    for i=1,times do
+        for _, h in ipairs(handles) do
+            shaco.sendum(h, data)
+        end
+    end
+    wait(handles, times)
+    local t2 = shaco.now()
+    for i=1,times do
+        shaco.broadcast(handles, 'um', data)
+    end
+    wait(handles, times)
+    local t3 = shaco.now()
+    print(string.format("agents %d times %d: send %dms, broadcast %dms", 
+        agents, times, t2-t1, t3-t2))
+    shaco.abort('benchmark_broadcast done')
+end)
@@ -0,0 +1,64 @@
+--[[
+accept storm, all clients connect at once as a reconnect after deploy
+usage: testaccept [clients], 2 sockets for a client, see maxsocket,
+the default fit it, eg. --maxsocket 8192 for 2000 clients
+compare --acceptbatch 1 with the default, count the accept4 and
+epoll_wait by strace -c -f
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local nclient = ...
+
+shaco.start(function()
+    local maxclient = (tonumber(shaco.getenv('maxsocket')) or 128)//2 - 8
+    nclient = tonumber(nclient) or math.min(2000, maxclient)
+    if nclient > maxclient then
+        print(string.format('%d clients over maxsocket, %d at most', nclient, maxclient))
+        shaco.abort('testaccept done')
+        return
+    end
+    local addr = '127.0.0.1:23462'
+    local accepted = 0
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        accepted = accepted + 1
+        socket.close(id)
+    end))
+
+    local t1 = shaco.now()
+    local connected, failed = 0, 0
+    for i=1,nclient do
+        shaco.fork(function()
+            local id = socket.connect(addr)
+            if id then
+                connected = connected + 1
+                socket.close(id)
+            else
+                failed = failed + 1
+            end
+        end)
+    end
+    -- the failed one is never accepted, and the accept may fail too,
+    -- give up if no progress for a while
+    local last, idle = 0, 0
+    while accepted < connected or connected + failed < nclient do
+        shaco.sleep(1)
+        local progress = accepted + connected + failed
+        if progress ~= last then
+            last, idle = progress, 0
+        else
+            idle = idle + 1
+            if idle >= 2000 then
+                print(string.format('no progress, accepted %d connected %d failed %d',
+                    accepted, connected, failed))
+                break
+            end
+        end
+    end
+    local elapsed = shaco.now()-t1
+    print(string.format('accept %d connections use %dms, %.0f conn/s, connect failed %d',
+        accepted, elapsed, accepted*1000/math.max(elapsed, 1), failed))
+    shaco.abort('testaccept done')
+end)
@@ -0,0 +1,97 @@
+--[[
+deferred socket send
+usage: testdefer [clients] [rounds] [replies]
+every request get some small replies, count the write syscalls (syscw in
+/proc/self/io) and the tcp segments (OutSegs in /proc/net/snmp),
+compare --senddefer 0 and 1
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local nclient, nround, nreply = ...
+nclient = tonumber(nclient) or 50
+nround = tonumber(nround) or 200
+nreply = tonumber(nreply) or 10
+
+local function readfile(name)
+    local f = io.open(name)
+    if not f then
+        return ''
+    end
+    local s = f:read('a')
+    f:close()
+    return s
+end
+
+local function syscw()
+    return tonumber(string.match(readfile('/proc/self/io'), 'syscw: (%d+)')) or 0
+end
+
+local function outsegs()
+    local head, value = string.match(readfile('/proc/net/snmp'), 
+        'Tcp: (%g[^\n]*)\nTcp: ([^\n]*)')
+    if not head then
+        return 0
+    end
+    local i = 0
+    for w in string.gmatch(head, '%S+') do
+        i = i + 1
+        if w == 'OutSegs' then
+            break
+        end
+    end
+    for w in string.gmatch(value, '%S+') do
+        i = i - 1
+        if i == 0 then
+            return tonumber(w)
+        end
+    end
+    return 0
+end
+
+shaco.start(function()
+    local addr = '127.0.0.1:23459'
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        socket.readon(id)
+        while true do
+            local s = socket.read(id, '\n')
+            if not s then
+                break
+            end
+            for i=1,nreply do
+                socket.send(id, s..' '..i..'\n')
+            end
+        end
+        socket.close(id)
+    end))
+
+    local w1, s1 = syscw(), outsegs()
+    local t1 = shaco.now()
+    local done = 0
+    for c=1,nclient do
+        shaco.fork(function()
+            local id = assert(socket.connect(addr))
+            socket.readon(id)
+            for k=1,nround do
+                socket.send(id, 'req'..k..'\n')
+                for i=1,nreply do
+                    assert(socket.read(id, '\n') == 'req'..k..' '..i)
+                end
+            end
+            socket.close(id)
+            done = done + 1
+        end)
+    end
+    while done < nclient do
+        shaco.sleep(1)
+    end
+    local nreq = nclient*nround
+    local w, s = syscw()-w1, outsegs()-s1
+    print(string.format('senddefer=%s requests %d replies %d use %dms',
+        shaco.getenv('senddefer') or 0, nreq, nreq*nreply, shaco.now()-t1))
+    print(string.format('write syscalls %d (%.1f per request), tcp segments %d (%.1f per request)',
+        w, w/nreq, s, s/nreq))
+    shaco.abort('testdefer done')
+end)
@@ -0,0 +1,155 @@
+--[[
+dns test with a stand-in name server on udp, check the resolve, the ttl
+cache, the concurrent query share, the AAAA fallback, the search domain,
+the error and the timeout, the service loop keep running when the server
+never answer
+usage: testdns
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+local dns = require "dns"
+local spack = string.pack
+local sunpack = string.unpack
+
+-- name -> ip, ttl; the slow name is never answered
+local records = {
+    ['test.shaco'] = { '127.0.0.1', 1 },
+    ['www.test.shaco'] = { '127.0.0.2', 60 },
+    ['v6.test.shaco'] = { '::1', 60 },
+}
+
+local nquery = 0
+
+-- answer the question by the records, the answer name use the pointer
+-- to the question
+local function answer(data)
+    local id, flags = sunpack('>I2I2', data)
+    local pos = 13
+    local labels = {}
+    while true do
+        local len = data:byte(pos)
+        if len == 0 then break end
+        labels[#labels+1] = data:sub(pos+1, pos+len)
+        pos = pos+len+1
+    end
+    local qtype = sunpack('>I2', data, pos+1)
+    local question = data:sub(13, pos+4)
+    local name = table.concat(labels, '.')
+    if name == 'slow.shaco' then
+        return
+    end
+    local r = records[name]
+    if not r then
+        return spack('>I2I2I2I2I2I2', id, 0x8183, 1, 0, 0, 0)..question
+    end
+    local v6 = r[1]:find(':', 1, true)
+    if qtype ~= (v6 and 28 or 1) then
+        return spack('>I2I2I2I2I2I2', id, 0x8180, 1, 0, 0, 0)..question
+    end
+    local rdata
+    if v6 then
+        rdata = spack('>I2I2I2I2I2I2I2I2', 0, 0, 0, 0, 0, 0, 0, 1)
+    else
+        rdata = spack('BBBB', r[1]:match('(%d+)%.(%d+)%.(%d+)%.(%d+)'))
+    end
+    return spack('>I2I2I2I2I2I2', id, 0x8180, 1, 1, 0, 0)..question..
+        spack('>I2I2I2I4s2', 0xc00c, qtype, 1, r[2], rdata)
+end
+
+shaco.start(function()
+    local server
+    server = assert(socket.udp(function(data, from)
+        nquery = nquery + 1
+        local ret = answer(data)
+        if ret then
+            socket.sendto(server, from, ret)
+        end
+    end, '127.0.0.1:23465'))
+    dns.server('127.0.0.1:23465', nil, 200, 2)
+    dns.search({}, 1)
+
+    -- resolve and connect by the name
+    local ip = assert(dns.resolve('test.shaco'))
+    assert(ip == '127.0.0.1', ip)
+    assert(nquery == 1)
+    local accepted = false
+    local lid = assert(socket.listen('test.shaco:23466', function(id)
+        socket.start(id)
+        accepted = true
+        socket.close(id)
+    end))
+    local id = assert(socket.connect('test.shaco', 23466))
+    socket.close(id)
+    while not accepted do
+        shaco.sleep(1)
+    end
+    assert(nquery == 1, 'cached')
+
+    -- expire by ttl
+    shaco.sleep(1100)
+    assert(dns.resolve('TEST.shaco') == '127.0.0.1')
+    assert(nquery == 2, 'ttl expired')
+
+    -- the concurrent resolve share one query
+    local n = 0
+    for i=1,10 do
+        shaco.fork(function()
+            assert(dns.resolve('www.test.shaco') == '127.0.0.2')
+            n = n + 1
+        end)
+    end
+    while n < 10 do
+        shaco.sleep(1)
+    end
+    assert(nquery == 3, 'shared query')
+
+    -- no such name, the ip and /etc/hosts need not query
+    local ip, err = dns.resolve('none.shaco')
+    assert(ip == nil and err:find('No such name'), err)
+    assert(dns.resolve('127.0.0.9') == '127.0.0.9')
+    assert(dns.resolve('::1') == '::1')
+    assert(dns.isip('::ffff:127.0.0.1') and not dns.isip('host:1'))
+    assert(nquery == 4)
+
+    -- no A record, then the AAAA record
+    local ip = assert(dns.resolve('v6.test.shaco'))
+    assert(ip == '0:0:0:0:0:0:0:1', ip)
+    assert(nquery == 6, 'fallback')
+    assert(dns.resolve('v6.test.shaco', true) == ip)
+    local lid6 = assert(socket.listen('::1:23467', function(id)
+        socket.close(id)
+    end))
+    local id = assert(socket.connect('v6.test.shaco', 23467))
+    socket.close(id)
+    socket.close(lid6)
+    assert(nquery == 6)
+
+    -- the name has dots less than ndots try the search domain first,
+    -- the absolute name never
+    dns.search({'test.shaco.'}, 1)
+    assert(dns.resolve('www') == '127.0.0.2')
+    assert(nquery == 6, 'search cached')
+    local ip, err = dns.resolve('www.')
+    assert(ip == nil and err:find('No such name'), err)
+    assert(nquery == 7)
+    dns.search({}, 1)
+
+    -- timeout and retry, the loop is not blocked
+    local ticks = 0
+    local tick = shaco.tick(10, function() ticks = ticks + 1 end)
+    local t1 = shaco.now()
+    local ip, err = dns.resolve('slow.shaco')
+    local elapsed = shaco.now()-t1
+    shaco.cancel(tick)
+    assert(ip == nil and err:find('Timeout'), err)
+    assert(nquery == 9, 'retry')
+    assert(ticks >= 20, ticks)
+    assert(socket.connect('slow.shaco:23466') == nil)
+
+    print(string.format('testdns ok, %d queries, timeout after %dms with %d ticks',
+        nquery, elapsed, ticks))
+    socket.close(lid)
+    socket.close(server)
+    shaco.abort('testdns done')
+end)
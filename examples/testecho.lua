@@ -0,0 +1,78 @@
+--[[
+echo benchmark, compare the network backend (epoll, or io_uring by
+make linux NP_FLAG=-DNP_URING)
+usage: testecho [clients] [rounds] [size], 2 sockets for a client, see maxsocket
+every client send a message and wait the echo back, then print the
+message rate and the read/write syscalls (syscr/syscw in /proc/self/io),
+the recv by io_uring is not counted in syscr
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local nclient, nround, size = ...
+nclient = tonumber(nclient) or 50
+nround = tonumber(nround) or 1000
+size = tonumber(size) or 64
+
+local function procio()
+    local f = io.open('/proc/self/io')
+    if not f then
+        return 0, 0
+    end
+    local s = f:read('a')
+    f:close()
+    return tonumber(string.match(s, 'syscr: (%d+)')),
+        tonumber(string.match(s, 'syscw: (%d+)'))
+end
+
+shaco.start(function()
+    local addr = '127.0.0.1:23460'
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        socket.readon(id)
+        while true do
+            local data = socket.read(id)
+            if not data then
+                break
+            end
+            socket.send(id, data)
+        end
+        socket.close(id)
+    end))
+
+    local clients = {}
+    for i=1,nclient do
+        local id = assert(socket.connect(addr))
+        socket.readon(id)
+        clients[i] = id
+    end
+    local msg = string.rep('x', size)
+    local r1, w1 = procio()
+    local t1 = shaco.now()
+    local done = 0
+    for _, id in ipairs(clients) do
+        shaco.fork(function()
+            for k=1,nround do
+                socket.send(id, msg)
+                local n = 0
+                while n < size do
+                    n = n + #assert(socket.read(id))
+                end
+            end
+            socket.close(id)
+            done = done + 1
+        end)
+    end
+    while done < nclient do
+        shaco.sleep(1)
+    end
+    local elapsed = shaco.now()-t1
+    local r2, w2 = procio()
+    local nmsg = nclient*nround
+    print(string.format('clients %d messages %d x %dB use %dms, %.0f msg/s',
+        nclient, nmsg, size, elapsed, nmsg*1000/math.max(elapsed, 1)))
+    print(string.format('read syscalls %d, write syscalls %d (%.2f per message)',
+        r2-r1, w2-w1, (r2-r1+w2-w1)/nmsg))
+    shaco.abort('testecho done')
+end)
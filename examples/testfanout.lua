@@ -0,0 +1,63 @@
+--[[
+fan-out benchmark, compare the level and edge triggered epoll (--edge 1)
+usage: testfanout [clients] [rounds] [burst] [size], 2 sockets for a client
+every round the server send a burst of messages to all clients, the send
+buffer fill up then wait writable, the next round start when all clients
+read the burst, count the epoll_ctl and epoll_wait by strace -c -f
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local nclient, nround, burst, size = ...
+nclient = tonumber(nclient) or 50
+nround = tonumber(nround) or 20
+burst = tonumber(burst) or 1024
+size = tonumber(size) or 4096
+
+shaco.start(function()
+    local addr = '127.0.0.1:23461'
+    local conns = {}
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        conns[#conns+1] = id
+    end))
+
+    local total = burst*size
+    local received = 0
+    for i=1,nclient do
+        local id = assert(socket.connect(addr))
+        socket.readon(id)
+        shaco.fork(function()
+            for k=1,nround do
+                local n = 0
+                while n < total do
+                    n = n + #assert(socket.read(id))
+                end
+                received = received + 1
+            end
+            socket.close(id)
+        end)
+    end
+    while #conns < nclient do
+        shaco.sleep(1)
+    end
+
+    local msg = string.rep('x', size)
+    local t1 = shaco.now()
+    for k=1,nround do
+        for _, id in ipairs(conns) do
+            for i=1,burst do
+                socket.send(id, msg)
+            end
+        end
+        while received < nclient*k do
+            shaco.sleep(1)
+        end
+    end
+    local elapsed = shaco.now()-t1
+    local nmsg = nclient*nround*burst
+    print(string.format('clients %d messages %d x %dB use %dms, %.0f msg/s',
+        nclient, nmsg, size, elapsed, nmsg*1000/math.max(elapsed, 1)))
+    shaco.abort('testfanout done')
+end)
@@ -0,0 +1,30 @@
+local shaco = require "shaco"
+local mode = ...
+
+-- launch and kill more than 255 (the local handle slot max) services,
+-- the slot is reused with a new generation, stale handle is rejected
+if mode == 'child' then
+    shaco.start(function()
+        shaco.dispatch('lua', function(source, session, cmd, n)
+            shaco.ret(shaco.pack(n+1))
+        end)
+    end)
+    return
+end
+
+shaco.start(function()
+    local first
+    local t1 = shaco.now()
+    for i=1,1000 do
+        local h = assert(shaco.newservice('testhandle child'))
+        first = first or h
+        shaco.register('.testhandle_child', h)
+        assert(shaco.call('.testhandle_child', 'lua', 'ping', i) == i+1)
+        assert(shaco.call(h, 'lua', 'ping', i) == i+1)
+        shaco.kill(tostring(h))
+    end
+    assert(shaco.send(first, 'lua', 'ping', 0) == false, 'stale handle')
+    assert(shaco.command('QUERY', 'testhandle_child') == nil, 'name unbind')
+    print(string.format('launch and kill 1000 services ok, use %dms', shaco.now()-t1))
+    shaco.abort('testhandle done')
+end)
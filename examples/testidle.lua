@@ -0,0 +1,92 @@
+--[[
+idle connections, the socket table grow by chunk on demand
+usage: testidle [clients], 2 sockets for a client, see maxsocket,
+the default fit it
+try a large maxsocket, eg. --maxsocket 1048576, the memory is used by
+the connections only, the stale id of the closed socket never reach the
+reused one
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+local c = require "socket.c"
+
+local nclient = ...
+
+local function rss()
+    local f = io.open('/proc/self/statm')
+    if not f then
+        return 0
+    end
+    local pages = f:read('n')
+    pages = f:read('n')
+    f:close()
+    return pages*4
+end
+
+shaco.start(function()
+    local maxclient = (tonumber(shaco.getenv('maxsocket')) or 128)//2 - 8
+    nclient = tonumber(nclient) or math.min(10000, maxclient)
+    if nclient > maxclient then
+        print(string.format('%d clients over maxsocket, %d at most', nclient, maxclient))
+        shaco.abort('testidle done')
+        return
+    end
+    local addr = '127.0.0.1:23469'
+    local accepted = {}
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        socket.readon(id)
+        accepted[#accepted+1] = id
+    end))
+
+    -- the slot is reused, but the id is not
+    local stale = assert(socket.connect(addr))
+    socket.close(stale)
+    local seen = { [stale] = true }
+    for i=1,1000 do
+        local id = assert(socket.connect(addr))
+        assert(not seen[id], 'id reused')
+        seen[id] = true
+        socket.close(id)
+    end
+    assert(c.send(stale, 'x') == nil, 'stale id')
+    for i=1,#accepted do
+        socket.close(accepted[i])
+    end
+    accepted = {}
+
+    local kb = rss()
+    local t1 = shaco.now()
+    local clients = {}
+    for i=1,nclient do
+        local id = socket.connect(addr)
+        if not id then
+            print('connect fail at '..i)
+            break
+        end
+        clients[i] = id
+    end
+    -- the accept may fail, give up if no progress for a while
+    local last, idle = 0, 0
+    while #accepted < #clients do
+        shaco.sleep(1)
+        if #accepted ~= last then
+            last, idle = #accepted, 0
+        else
+            idle = idle + 1
+            if idle >= 2000 then
+                print(string.format('no progress, accepted %d of %d', #accepted, #clients))
+                break
+            end
+        end
+    end
+    local elapsed = shaco.now()-t1
+    local used = rss()-kb
+    print(string.format('idle %d connections use %dms, rss %dKB, %.0f bytes per socket',
+        #clients, elapsed, used, used*1024/math.max(#clients*2, 1)))
+    for i=1,#clients do
+        socket.close(clients[i])
+    end
+    shaco.abort('testidle done')
+end)
@@ -0,0 +1,42 @@
+local shaco = require "shaco"
+local multicast = require "multicast"
+local mode, channel = ...
+
+if mode == 'sub' then
+    shaco.start(function()
+        local count = 0
+        local last
+        multicast.subscribe(tonumber(channel), function(source, i, data)
+            count = count + 1
+            last = i
+        end)
+        shaco.dispatch('lua', function(source, session, cmd)
+            shaco.ret(shaco.pack(count, last))
+        end)
+    end)
+    return
+end
+
+shaco.start(function()
+    local id = multicast.create()
+    local subs = {}
+    for i=1,10 do
+        subs[i] = assert(shaco.newservice('testmulticast sub '..id))
+    end
+    local data = string.rep('x', 1024)
+    for i=1,100 do
+        assert(multicast.publish(id, i, data) == #subs)
+    end
+    for _, h in ipairs(subs) do
+        local count, last = shaco.call(h, 'lua', 'count')
+        assert(count == 100 and last == 100)
+    end
+    -- the gone subscriber is removed on publish
+    shaco.kill(tostring(table.remove(subs)))
+    assert(multicast.publish(id, 101, data) == #subs)
+    assert(multicast.publish(id, 102, data) == #subs)
+    multicast.delete(id)
+    assert(not pcall(multicast.publish, id, 103, data))
+    print('testmulticast ok')
+    shaco.abort('testmulticast done')
+end)
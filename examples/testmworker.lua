@@ -0,0 +1,95 @@
+--[[
+mworker accept benchmark, compare the master relay with SO_REUSEPORT
+usage: testmworker server [worker] [reuseport]
+       testmworker client [connections] [concurrency] [server log]
+start the server in one process and the client in another, every client
+connection echo one line by worker, then get the reply of master_handler,
+give the file the server log to, the client check it has no cb error
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+local mworker = require "mworker"
+
+local role, a1, a2, a3 = ...
+local addr = '127.0.0.1:23464'
+
+if role == 'server' then
+    local server = {
+        address = addr,
+        worker = tonumber(a1) or 4,
+        reuseport = a2 == '1' or a2 == 'true',
+    }
+    function server.worker_handler(id)
+        socket.readon(id)
+        local s = assert(socket.read(id, '\n'))
+        assert(socket.send(id, s..'\n'))
+        return s
+    end
+    function server.master_handler(id, worker, s)
+        socket.send(id, '200 '..worker..'\n')
+    end
+    mworker(server)
+else
+    local nconn = tonumber(a1) or 10000
+    local concurrency = tonumber(a2) or 100
+    shaco.start(function()
+        local done, failed = 0, 0
+        local workers = {}
+        local function client()
+            local id = socket.connect(addr)
+            if not id then
+                return false
+            end
+            socket.readon(id)
+            socket.send(id, 'hello\n')
+            local ok = socket.read(id, '\n') == 'hello'
+            local reply = ok and socket.read(id, '\n')
+            socket.close(id)
+            if not reply then
+                return false
+            end
+            local worker = reply:match('^200 (%S+)')
+            workers[worker] = (workers[worker] or 0) + 1
+            return true
+        end
+        local t1 = shaco.now()
+        local started = 0
+        for i=1,concurrency do
+            shaco.fork(function()
+                while started < nconn do
+                    started = started + 1
+                    if not client() then
+                        failed = failed + 1
+                    end
+                    done = done + 1
+                end
+            end)
+        end
+        while done < nconn do
+            shaco.sleep(1)
+        end
+        local elapsed = shaco.now()-t1
+        print(string.format('connections %d (failed %d) concurrency %d use %dms, %.0f conn/s',
+            nconn, failed, concurrency, elapsed, nconn*1000/math.max(elapsed, 1)))
+        for worker, n in pairs(workers) do
+            print(string.format('  worker %s: %d', worker, n))
+        end
+        if a3 then
+            local f = assert(io.open(a3))
+            local nerr = 0
+            for line in f:lines() do
+                if line:find('cb error', 1, true) then
+                    nerr = nerr + 1
+                    print(line)
+                end
+            end
+            f:close()
+            print(string.format('server log: %d cb error', nerr))
+            if nerr > 0 then
+                shaco.abort('testmworker failed')
+            end
+        end
+        shaco.abort('testmworker done')
+    end)
+end
@@ -0,0 +1,55 @@
+--[[
+socket read buffer pool
+usage: testrbuf [clients] [rounds]
+echo lines of mixed size, then print the pool hit rate,
+run with --rbufpool 0 to compare with the pool disabled
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local nclient, nround = ...
+nclient = tonumber(nclient) or 16
+nround = tonumber(nround) or 2000
+
+shaco.start(function()
+    local addr = '127.0.0.1:23457'
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        socket.readon(id)
+        while true do
+            local s = socket.read(id, '\n')
+            if not s then
+                break
+            end
+            socket.send(id, s..'\n')
+        end
+        socket.close(id)
+    end))
+
+    local t1 = shaco.now()
+    local done = 0
+    for i=1,nclient do
+        shaco.fork(function()
+            local id = assert(socket.connect(addr))
+            socket.readon(id)
+            for k=1,nround do
+                local line = string.rep('x', (k*37)%3000)..k
+                socket.send(id, line..'\n')
+                assert(socket.read(id, '\n') == line)
+            end
+            socket.close(id)
+            done = done + 1
+        end)
+    end
+    while done < nclient do
+        shaco.sleep(10)
+    end
+    local st = socket.rbufstat()
+    local total = st.hit + st.miss
+    print(string.format('echo %d lines use %dms', nclient*nround, shaco.now()-t1))
+    print(string.format('rbuf hit %d miss %d (%.1f%%) recycle %d drop %d cached %d (%dKB)',
+        st.hit, st.miss, total > 0 and st.hit*100/total or 0,
+        st.recycle, st.drop, st.cached, st.cached_bytes//1024))
+    shaco.abort('testrbuf done')
+end)
@@ -0,0 +1,66 @@
+--[[
+read backpressure test, a fast sender flood a slow reader
+usage: testreadlimit [total MB] [high KB]
+the reader pause the read when the data read but not consumed grow up to
+high, the sender is throttled by the tcp flow control and wait writable
+by the watermark, high 0 to read without limit, then all the stream
+queue in the reader buffer
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local total, high = ...
+total = (tonumber(total) or 32)*1024*1024
+high = (tonumber(high) or 256)*1024
+
+shaco.start(function()
+    local addr = '127.0.0.1:23468'
+    local chunk = 16*1024
+    local sent, consumed, peak = 0, 0, 0
+    local closed = false
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        assert(socket.watermark(id, 64*1024))
+        local msg = string.rep('x', chunk)
+        while sent < total do
+            if not socket.send(id, msg) then
+                closed = true
+                break
+            end
+            sent = sent + chunk
+            if sent - consumed > peak then
+                peak = sent - consumed
+            end
+            if socket.blocked(id) and not socket.writable(id) then
+                closed = true
+                break
+            end
+        end
+        socket.close(id, false)
+    end))
+
+    local t1 = shaco.now()
+    local id = assert(socket.connect(addr))
+    if high > 0 then
+        assert(socket.readlimit(id, high))
+    end
+    socket.readon(id)
+    local n = 0
+    while consumed < total do
+        local data = assert(socket.read(id, 4096))
+        consumed = consumed + #data
+        n = n + #data
+        -- slow reader
+        if n >= 256*1024 then
+            n = 0
+            shaco.sleep(1)
+        end
+    end
+    socket.close(id)
+    assert(not closed, 'sender closed')
+    local elapsed = shaco.now()-t1
+    print(string.format('stream %dMB readlimit %dKB use %dms, peak unconsumed %dKB',
+        total//(1024*1024), high//1024, elapsed, peak//1024))
+    shaco.abort('testreadlimit done')
+end)
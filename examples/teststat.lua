@@ -0,0 +1,72 @@
+--[[
+socket io stat, find the slow client by socket.top
+usage: teststat [clients]
+every client echo the stream, one of them never read, its send buffer
+grow up and it is the first of socket.top by sbuffer
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local nclient = ...
+nclient = tonumber(nclient) or 10
+
+shaco.start(function()
+    local addr = '127.0.0.1:23471'
+    local servers = {}
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        servers[#servers+1] = id
+    end))
+
+    local clients = {}
+    for i=1,nclient do
+        local id = assert(socket.connect(addr))
+        clients[i] = id
+        if i ~= 1 then
+            socket.readon(id)
+            shaco.fork(function()
+                while socket.read(id) do
+                end
+            end)
+        end
+    end
+    while #servers < nclient do
+        shaco.sleep(1)
+    end
+
+    -- the client 1 is the slow one, its server side hold the data
+    local msg = string.rep('x', 64*1024)
+    for round=1,64 do
+        for i=1,nclient do
+            socket.send(servers[i], msg)
+        end
+        shaco.sleep(1)
+    end
+
+    local st
+    for i=1,100 do
+        st = assert(socket.stat(clients[2]))
+        if st.rbytes == 64*#msg then
+            break
+        end
+        shaco.sleep(10)
+    end
+    assert(st.rbytes == 64*#msg and st.rcount > 0, st.rbytes)
+    assert(st.rtt == nil or st.rtt >= 0)
+    local st = assert(socket.stat(servers[2]))
+    assert(st.wbytes == 64*#msg, st.wbytes)
+    assert(st.sbuffer == 0 and st.protocol == 'tcp')
+
+    local top = socket.top(3, 'sbuffer')
+    assert(top[1].id == servers[1], 'the slow one first')
+    for i, st in ipairs(top) do
+        print(string.format('[%d] sbuffer %dKB write %dKB idle %dms',
+            st.id, st.sbuffer//1024, st.wbytes//1024, st.idle))
+    end
+    local top = socket.top(nclient*2, 'rate')
+    assert(#top == nclient*2)
+    assert(socket.stat(-1) == nil)
+    print('teststat ok')
+    shaco.abort('teststat done')
+end)
@@ -0,0 +1,86 @@
+local shaco = require "shaco"
+local mode, count = ...
+
+-- count entities tick at 100ms, check the tick count and drift,
+-- cancel from outside and inside the tick func
+local function test()
+    local t1 = shaco.now()
+    local ticks = 0
+    local handles = {}
+    for i=1,count do
+        handles[i] = shaco.tick(100, function()
+            ticks = ticks + 1
+        end)
+    end
+    local n = 0
+    local maxlate = 0
+    local self
+    self = shaco.tick(50, function()
+        n = n + 1
+        local late = shaco.now() - t1 - n*50
+        if late > maxlate then maxlate = late end
+        if n == 20 then
+            assert(shaco.cancel(self))
+        end
+    end)
+    shaco.sleep(1050)
+    for i=1,count do
+        assert(shaco.cancel(handles[i]))
+    end
+    local total = ticks
+    shaco.sleep(300)
+    assert(ticks == total, 'tick after cancel')
+    assert(n == 20, n)
+    assert(total >= count*9 and total <= count*10, total)
+    print(string.format('%d ticks of %d entities ok, max late %dms, use %dms',
+        total, count, maxlate, shaco.now()-t1))
+end
+
+-- cpu time of count entities tick at 100ms for 2s,
+-- timeout re-registered every tick vs shaco.tick
+local function bench()
+    local stop = false
+    local ticks = 0
+    local function run(name, start)
+        stop = false
+        ticks = 0
+        local c1 = os.clock()
+        for i=1,count do
+            start(i)
+        end
+        shaco.sleep(2000)
+        stop = true
+        shaco.sleep(200)
+        print(string.format('%-7s %d ticks, cpu %.0fms', name, ticks, (os.clock()-c1)*1000))
+    end
+    run('timeout', function()
+        local function f()
+            if not stop then
+                ticks = ticks + 1
+                shaco.timeout(100, f)
+            end
+        end
+        shaco.timeout(100, f)
+    end)
+    local handles = {}
+    run('tick', function(i)
+        handles[i] = shaco.tick(100, function()
+            if not stop then
+                ticks = ticks + 1
+            end
+        end)
+    end)
+    for i=1,count do
+        shaco.cancel(handles[i])
+    end
+end
+
+shaco.start(function()
+    count = tonumber(count) or 2000
+    if mode == 'bench' then
+        bench()
+    else
+        test()
+    end
+    shaco.abort('testtick done')
+end)
@@ -0,0 +1,32 @@
+local shaco = require "shaco"
+
+-- cancel timeout and break sleep, the cancelled timer never fire
+shaco.start(function()
+    local t1 = shaco.now()
+    local fired = 0
+    local handles = {}
+    for i=1,10000 do
+        handles[i] = shaco.timeout(100 + i%50, function()
+            assert(i%2 == 0, 'cancelled timer fired')
+            fired = fired + 1
+        end)
+    end
+    for i=1,10000,2 do
+        assert(shaco.cancel(handles[i]))
+    end
+
+    -- wakeup a long sleep, no late message for the session
+    local co
+    shaco.fork(function()
+        co = coroutine.running()
+        assert(shaco.sleep(60000) == 'BREAK')
+    end)
+    shaco.sleep(10)
+    shaco.wakeup(co)
+
+    shaco.sleep(300)
+    assert(fired == 5000, fired)
+    assert(shaco.cancel(handles[2]) == false, 'cancel after fired')
+    print(string.format('cancel 5000 timers ok, use %dms', shaco.now()-t1))
+    shaco.abort('testtimer done')
+end)
@@ -0,0 +1,66 @@
+--[[
+udp benchmark, the datagram rate on one core (--thread 0)
+usage: testudp [datagrams] [window] [size]
+a connected client keep window datagrams in flight to the server, the
+server echo them by sendto the from address, try --senddefer 1 to batch
+the echo by sendmmsg, the recv is batched by recvmmsg always
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local total, window, size = ...
+total = tonumber(total) or 200000
+window = tonumber(window) or 128
+size = tonumber(size) or 64
+
+shaco.start(function()
+    local server
+    server = assert(socket.udp(function(data, from)
+        socket.sendto(server, from, data)
+    end, '127.0.0.1:23463'))
+
+    -- check the from address and the connected send first
+    local checked = false
+    local check = assert(socket.udp(function(data, from)
+        local ip, port = socket.udp_address(from)
+        assert(ip == '127.0.0.1' and port == 23463, ip)
+        assert(data == 'hello')
+        checked = true
+    end))
+    assert(socket.udp_connect(check, '127.0.0.1', 23463))
+    assert(socket.send(check, 'hello'))
+    while not checked do
+        shaco.sleep(1)
+    end
+    socket.close(check)
+
+    local msg = string.rep('x', size)
+    local sent, recv = 0, 0
+    local client
+    client = assert(socket.udp(function(data)
+        recv = recv + 1
+        if sent < total then
+            sent = sent + 1
+            socket.send(client, msg)
+        end
+    end))
+    assert(socket.udp_connect(client, '127.0.0.1:23463'))
+    local t1 = shaco.now()
+    while sent < window do
+        sent = sent + 1
+        socket.send(client, msg)
+    end
+    -- the datagram may be dropped, stop when no progress
+    local last = -1
+    while recv < total and recv ~= last do
+        last = recv
+        shaco.sleep(10)
+    end
+    local elapsed = shaco.now()-t1
+    print(string.format('datagrams %d x %dB, echo %d (lost %d) use %dms, %.0f datagrams/s',
+        total, size, recv, total-recv, elapsed, recv*2*1000/math.max(elapsed, 1)))
+    socket.close(client)
+    socket.close(server)
+    shaco.abort('testudp done')
+end)
@@ -0,0 +1,136 @@
+--[[
+unix domain socket for the same host services
+usage: testunix [clients] [rounds] [size], 2 sockets for a client, see maxsocket
+the address "unix:/path" is the stream, "unixpacket:/path" is the seqpacket,
+the path start with @ is in the linux abstract namespace, the seqpacket
+keep the message boundary, one message for one read, then compare the
+echo message rate of the tcp loopback and the unix socket
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local nclient, nround, size = ...
+nclient = tonumber(nclient) or 50
+nround = tonumber(nround) or 1000
+size = tonumber(size) or 64
+
+-- the echo not exit yet, the next bench wait them to free the sockets
+local nserver = 0
+
+local function echo(id)
+    nserver = nserver + 1
+    socket.start(id)
+    socket.readon(id)
+    while true do
+        local data = socket.read(id)
+        if not data then
+            break
+        end
+        socket.send(id, data)
+    end
+    socket.close(id)
+    nserver = nserver - 1
+end
+
+local function bench(addr)
+    local lid = assert(socket.listen(addr, echo), addr)
+    local clients = {}
+    for i=1,nclient do
+        local id = assert(socket.connect(addr))
+        socket.readon(id)
+        clients[i] = id
+    end
+    local msg = string.rep('x', size)
+    local t1 = shaco.now()
+    local done = 0
+    for _, id in ipairs(clients) do
+        shaco.fork(function()
+            for k=1,nround do
+                socket.send(id, msg)
+                local n = 0
+                while n < size do
+                    n = n + #assert(socket.read(id))
+                end
+            end
+            socket.close(id)
+            done = done + 1
+        end)
+    end
+    while done < nclient do
+        shaco.sleep(1)
+    end
+    local elapsed = shaco.now()-t1
+    local nmsg = nclient*nround
+    print(string.format('%-44s messages %d x %dB use %dms, %.0f msg/s',
+        addr, nmsg, size, elapsed, nmsg*1000/math.max(elapsed, 1)))
+    socket.close(lid)
+    while nserver > 0 do
+        shaco.sleep(1)
+    end
+end
+
+-- every send is one message for the peer, count by the reads
+local function boundary(addr)
+    local nmsg = 100
+    local total = 0
+    for i=1,nmsg do
+        total = total + i
+    end
+    local st
+    local lid = assert(socket.listen(addr, function(id)
+        socket.start(id)
+        socket.readon(id)
+        local n = 0
+        while n < total do
+            n = n + #assert(socket.read(id))
+        end
+        st = socket.stat(id)
+        socket.close(id)
+    end))
+    local id = assert(socket.connect(addr))
+    for i=1,nmsg do
+        socket.send(id, string.rep('x', i))
+    end
+    while not st do
+        shaco.sleep(1)
+    end
+    assert(st.rbytes == total and st.rcount == nmsg, st.rcount)
+    -- larger than the read buffer, the peer close it
+    local closed = false
+    local big = assert(socket.listen(addr..'.big', function(id)
+        socket.start(id)
+        socket.readon(id)
+        closed = socket.read(id) == nil
+    end))
+    local id2 = assert(socket.connect(addr..'.big'))
+    socket.send(id2, string.rep('x', 100*1024))
+    while not closed do
+        shaco.sleep(1)
+    end
+    socket.close(id)
+    socket.close(id2)
+    socket.close(lid)
+    socket.close(big)
+end
+
+shaco.start(function()
+    local path = '/tmp/shaco_testunix.sock'
+    -- the path left by the closed listener is removed by the next listen,
+    -- but not the one in use
+    local lid = assert(socket.listen('unix:'..path, echo))
+    assert(not socket.listen('unix:'..path, echo), 'path in use')
+    socket.close(lid)
+    boundary('unixpacket:'..path..'.packet')
+    boundary('unixpacket:@shaco_testunix.packet')
+
+    bench('127.0.0.1:23472')
+    bench('unix:'..path)
+    bench('unixpacket:'..path..'.packet')
+    bench('unix:@shaco_testunix')
+    os.remove(path)
+    os.remove(path..'.packet')
+    os.remove(path..'.packet.big')
+    print('testunix ok')
+    shaco.abort('testunix done')
+end)
@@ -0,0 +1,21 @@
+local shaco = require "shaco"
+local usec, count = ...
+
+-- usleep count times, print the error in usec, negative is early,
+-- run with --hrtimer 1 for the timerfd, else it is msec resolution
+shaco.start(function()
+    usec = tonumber(usec) or 500
+    count = tonumber(count) or 200
+    local sum, min, max = 0, math.maxinteger, math.mininteger
+    for i=1,count do
+        local t1 = shaco.now_us()
+        shaco.usleep(usec)
+        local err = shaco.now_us() - t1 - usec
+        sum = sum + err
+        if err < min then min = err end
+        if err > max then max = err end
+    end
+    print(string.format('usleep %dus x %d: error mean %dus, min %dus, max %dus',
+        usec, count, sum//count, min, max))
+    shaco.abort('testusleep done')
+end)
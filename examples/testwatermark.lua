@@ -0,0 +1,62 @@
+--[[
+send watermark test, stream to a slow reader
+usage: testwatermark [total MB] [high KB] [chunk KB]
+the producer wait socket.writable after every send, so the send buffer
+hold no more than the high watermark, high 0 to send without waiting,
+then all the stream queue in the send buffer
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local total, high, chunk = ...
+total = (tonumber(total) or 64)*1024*1024
+high = (tonumber(high) or 256)*1024
+chunk = (tonumber(chunk) or 16)*1024
+
+shaco.start(function()
+    local addr = '127.0.0.1:23467'
+    local nblocked = 0
+    local sent, peak = 0, 0
+    local received = 0
+    local done = false
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        if high > 0 then
+            assert(socket.watermark(id, high))
+        end
+        local msg = string.rep('x', chunk)
+        while sent < total do
+            assert(socket.send(id, msg))
+            sent = sent + chunk
+            if sent - received > peak then
+                peak = sent - received
+            end
+            if socket.blocked(id) then
+                nblocked = nblocked + 1
+                assert(socket.writable(id))
+            end
+        end
+        socket.close(id, false)
+    end))
+
+    local t1 = shaco.now()
+    local id = assert(socket.connect(addr))
+    socket.readon(id)
+    local n = 0
+    while received < total do
+        local data = assert(socket.read(id))
+        received = received + #data
+        n = n + #data
+        -- slow reader
+        if n >= 256*1024 then
+            n = 0
+            shaco.sleep(1)
+        end
+    end
+    socket.close(id)
+    local elapsed = shaco.now()-t1
+    print(string.format('stream %dMB high %dKB use %dms, peak in flight %dKB, blocked %d times',
+        total//(1024*1024), high//1024, elapsed, peak//1024, nblocked))
+    shaco.abort('testwatermark done')
+end)
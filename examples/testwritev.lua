@@ -0,0 +1,73 @@
+--[[
+send buffer flush
+usage: testwritev [clients] [packets] [packet size]
+queue packets to clients not reading, then let them read and count the
+write syscalls (syscw in /proc/self/io) used to drain the send buffers
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local nclient, npack, packsz = ...
+nclient = tonumber(nclient) or 8
+npack = tonumber(npack) or 40000
+packsz = tonumber(packsz) or 256
+
+local function syscw()
+    local f = io.open('/proc/self/io')
+    if not f then
+        return 0
+    end
+    local s = f:read('a')
+    f:close()
+    return tonumber(string.match(s, 'syscw: (%d+)'))
+end
+
+shaco.start(function()
+    local addr = '127.0.0.1:23458'
+    local accepted = {}
+    assert(socket.listen(addr, function(id)
+        socket.start(id)
+        accepted[#accepted+1] = id
+    end))
+
+    local clients = {}
+    for i=1,nclient do
+        clients[i] = assert(socket.connect(addr))
+    end
+    while #accepted < nclient do
+        shaco.sleep(1)
+    end
+
+    -- broadcast burst, the tail is queued when the kernel buffer is full
+    local pack = string.rep('x', packsz)
+    local w1 = syscw()
+    for k=1,npack do
+        for _, id in ipairs(accepted) do
+            assert(socket.send(id, pack))
+        end
+    end
+    local w2 = syscw()
+
+    local t1 = shaco.now()
+    local done = 0
+    local total = npack*packsz
+    for _, id in ipairs(clients) do
+        shaco.fork(function()
+            socket.readon(id)
+            local n = 0
+            while n < total do
+                n = n + #assert(socket.read(id))
+            end
+            done = done + 1
+        end)
+    end
+    while done < nclient do
+        shaco.sleep(1)
+    end
+    local w3 = syscw()
+    print(string.format('clients %d packets %d x %dB', nclient, npack, packsz))
+    print(string.format('burst write syscalls %d, drain write syscalls %d, use %dms',
+        w2-w1, w3-w2, shaco.now()-t1))
+    shaco.abort('testwritev done')
+end)
@@ -0,0 +1,63 @@
+--[[
+zerocopy send benchmark, the cpu time per GB sent with and without
+MSG_ZEROCOPY (linux 4.14+)
+usage: testzerocopy [total MB] [message KB] [sink address]
+stream total MB by the large message, the sender wait writable by the
+watermark, the cpu time is the process one (os.clock), the loopback
+receiver is in the same process and the kernel copy it anyway (then the
+zerocopy is stopped, see zcopied), give the address of a sink on the
+other host (eg. nc -l 23473 > /dev/null) to see the gain
+]]
+
+local shaco = require "shaco"
+local socket = require "socket"
+
+local total, size, sink = ...
+total = (tonumber(total) or 1024)*1024*1024
+size = (tonumber(size) or 1024)*1024
+
+local function run(addr, threshold)
+    local id = assert(socket.connect(addr))
+    assert(socket.watermark(id, 4*size))
+    if threshold > 0 and not socket.zerocopy(id, threshold) then
+        print('zerocopy no support')
+        socket.close(id)
+        return
+    end
+    local msg = string.rep('x', size)
+    local c1 = os.clock()
+    local t1 = shaco.now()
+    local sent = 0
+    while sent < total do
+        assert(socket.send(id, msg))
+        sent = sent + size
+        if socket.blocked(id) then
+            assert(socket.writable(id))
+        end
+    end
+    local c2 = os.clock()
+    local elapsed = shaco.now()-t1
+    local st = socket.stat(id)
+    local gb = total/(1024*1024*1024)
+    print(string.format('zerocopy %-8d sent %dMB use %dms, cpu %.0fms per GB, zerocopy %dMB copied %d',
+        threshold, total//(1024*1024), elapsed, (c2-c1)*1000/gb,
+        (st.zbytes or 0)//(1024*1024), st.zcopied or 0))
+    socket.close(id, false)
+end
+
+shaco.start(function()
+    local addr = sink
+    if not addr then
+        addr = '127.0.0.1:23473'
+        assert(socket.listen(addr, function(id)
+            socket.start(id)
+            socket.readon(id)
+            while socket.read(id) do
+            end
+            socket.close(id)
+        end))
+    end
+    run(addr, 0)
+    run(addr, 64*1024)
+    shaco.abort('testzerocopy done')
+end)
@@ -2,8 +2,8 @@ local shaco = require "shaco"
 
 shaco.start(function()
     local handle
+    -- launcher register itself in init, it may start before LAUNCH return
     handle = assert(tonumber(shaco.command('LAUNCH', 'lua launcher')))
-    shaco.command('REG', 'launcher '..handle)
 
     local con = shaco.getenv('console')
     if con and con ~= "0" then
@@ -1,5 +1,7 @@
 local shaco = require "shaco"
 
+shaco.command('REG', 'launcher '..shaco.handle())
+
 shaco.start(function()
     local instances = {}
 
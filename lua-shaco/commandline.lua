@@ -6,6 +6,7 @@ local sformat = string.format
 local assert = assert
 local select = select
 local pairs = pairs
+local ipairs = ipairs
 local type = type
 local loadfile = loadfile
 local debug = debug
@@ -52,6 +53,46 @@ function command.loglevel(level)
     return shaco.command("GETLOGLEVEL")
 end
 
+function command.mqlen(name)
+    if name then
+        return shaco.command("MQLEN", name)
+    end
+    local t = {}
+    for handle, len in pairs(shaco.mqstat()) do
+        t[#t+1] = {handle, len}
+    end
+    table.sort(t, function(a, b) return a[2] > b[2] end)
+    for i, v in ipairs(t) do
+        t[i] = sformat("[%02x] %d", v[1], v[2])
+    end
+    return table.concat(t, '\n')
+end
+
+function command.rbuf()
+    local socket = require "socket"
+    local st = socket.rbufstat()
+    local total = st.hit + st.miss
+    return sformat("hit %d miss %d (%.1f%%) recycle %d drop %d cached %d (%dKB)",
+        st.hit, st.miss, total > 0 and st.hit*100/total or 0,
+        st.recycle, st.drop, st.cached, st.cached_bytes//1024)
+end
+
+-- the top n sockets by sbuffer (queued to send), rate (bytes per second
+-- since the last call) or idle
+function command.socktop(n, by)
+    local socket = require "socket"
+    local t = socket.top(tonumber(n) or 10, by)
+    for i, st in ipairs(t) do
+        local info = socket.stat(st.id)
+        local rtt = info and info.rtt and
+            sformat(" rtt %.1fms retrans %d", info.rtt/1000, info.retrans) or ""
+        t[i] = sformat("[%d] %s fd %d sbuffer %dKB rate %dKB/s read %dKB write %dKB idle %ds%s",
+            st.id, st.protocol, st.fd, st.sbuffer//1024, st.rate//1024,
+            st.rbytes//1024, st.wbytes//1024, st.idle//1000, rtt)
+    end
+    return table.concat(t, '\n')
+end
+
 function command.start(name, ...)
     assert(name, 'no name')
     local args = {...}
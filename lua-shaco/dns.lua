@@ -0,0 +1,397 @@
+local shaco = require "shaco"
+local socket = require "socket"
+local sbyte = string.byte
+local slower = string.lower
+local smatch = string.match
+local sformat = string.format
+local spack = string.pack
+local sunpack = string.unpack
+local tconcat = table.concat
+local tinsert = table.insert
+local random = math.random
+
+-- resolve the host name in the service loop by the udp socket, no
+-- getaddrinfo block the thread, the answer is cached by its ttl
+
+local dns = {}
+
+local QTYPE_A = 1
+local QTYPE_AAAA = 28
+local QCLASS_IN = 1
+local NODATA_TTL = 10 -- the name has no record of the type, cache it too
+
+local _server      -- "ip:port"
+local _timeout = 1000
+local _retry = 2
+local _id = false  -- udp socket
+local _query = {}  -- transaction id -> query
+local _waiting = {} -- name..qtype -> query, the same name share a query
+local _cache = {}  -- name..qtype -> {expire, addrs or err}
+local _hosts
+local _search      -- the search domains
+local _ndots = 1   -- the name has dots less than it try the search first
+
+local function load_hosts()
+    _hosts = {}
+    local f = io.open('/etc/hosts')
+    if not f then
+        return
+    end
+    for line in f:lines() do
+        line = smatch(line, '^([^#]*)')
+        local ip, names = smatch(line, '^%s*(%S+)%s+(.+)$')
+        if ip then
+            local qtype = ip:find(':', 1, true) and QTYPE_AAAA or QTYPE_A
+            for name in names:gmatch('%S+') do
+                local key = slower(name)..qtype
+                if not _hosts[key] then
+                    _hosts[key] = {ip}
+                else tinsert(_hosts[key], ip)
+                end
+            end
+        end
+    end
+    f:close()
+end
+
+-- the first nameserver, the search (or domain) and the ndots option,
+-- the last search or domain line win as the resolver do
+local function load_conf()
+    local server, ndots
+    local search = {}
+    local f = io.open('/etc/resolv.conf')
+    if f then
+        for line in f:lines() do
+            line = smatch(line, '^([^#;]*)')
+            local key, value = smatch(line, '^%s*(%a+)%s+(.-)%s*$')
+            if key == 'nameserver' then
+                -- the ipv6 scope id is not supported
+                if not server and smatch(value, '^[%x:%.]+$') then
+                    server = value..':53'
+                end
+            elseif key == 'search' or key == 'domain' then
+                search = {}
+                for domain in value:gmatch('%S+') do
+                    search[#search+1] = slower((domain:gsub('%.$', '')))
+                end
+            elseif key == 'options' then
+                local n = smatch(value, 'ndots:(%d+)')
+                if n then
+                    ndots = math.min(tonumber(n), 15)
+                end
+            end
+        end
+        f:close()
+    end
+    _server = _server or server or '127.0.0.1:53'
+    if not _search then
+        _search = search
+        _ndots = ndots or _ndots
+    end
+end
+
+local function pack_question(id, name, qtype)
+    local t = { spack('>I2I2I2I2I2I2', id, 0x0100, 1, 0, 0, 0) } -- RD
+    for label in name:gmatch('[^%.]+') do
+        t[#t+1] = spack('s1', label)
+    end
+    t[#t+1] = spack('>BI2I2', 0, qtype, QCLASS_IN)
+    return tconcat(t)
+end
+
+-- return name, next pos, follow the compression pointer
+local function unpack_name(data, pos)
+    local labels = {}
+    local next_pos
+    for i=1, 128 do
+        local len = sbyte(data, pos)
+        if not len then
+            error('Invalid name')
+        elseif len == 0 then
+            return tconcat(labels, '.'), next_pos or pos+1
+        elseif len >= 0xc0 then
+            local offset = sunpack('>I2', data, pos) & 0x3fff
+            next_pos = next_pos or pos+2
+            pos = offset+1
+        else
+            labels[#labels+1] = data:sub(pos+1, pos+len)
+            pos = pos+len+1
+        end
+    end
+    error('Invalid name')
+end
+
+local function unpack_address(qtype, data, pos, len)
+    if qtype == QTYPE_A and len == 4 then
+        return sformat('%d.%d.%d.%d', sbyte(data, pos, pos+3))
+    elseif qtype == QTYPE_AAAA and len == 16 then
+        return sformat('%x:%x:%x:%x:%x:%x:%x:%x', sunpack('>I2I2I2I2I2I2I2I2', data, pos))
+    end
+end
+
+-- return addrs, ttl or nil, error
+local function unpack_answer(q, data)
+    local id, flags, qdcount, ancount = sunpack('>I2I2I2I2', data)
+    if flags & 0x8000 == 0 then
+        return nil, 'Not response'
+    end
+    local rcode = flags & 0xf
+    if rcode == 3 then
+        return nil, 'No such name'
+    elseif rcode ~= 0 then
+        return nil, 'Server error '..rcode
+    end
+    local pos = 13
+    for i=1, qdcount do
+        local name
+        name, pos = unpack_name(data, pos)
+        if slower(name) ~= q.name then
+            return nil, 'Question dismatch'
+        end
+        pos = pos + 4
+    end
+    local addrs = {}
+    local ttl
+    for i=1, ancount do
+        local _, typ, class, t, len
+        _, pos = unpack_name(data, pos)
+        typ, class, t, len, pos = sunpack('>I2I2I4I2', data, pos)
+        if class == QCLASS_IN and typ == q.qtype then
+            local addr = unpack_address(typ, data, pos, len)
+            if addr then
+                addrs[#addrs+1] = addr
+                if not ttl or t < ttl then
+                    ttl = t
+                end
+            end
+        end
+        pos = pos + len
+    end
+    if #addrs == 0 then
+        return nil, 'No address'
+    end
+    return addrs, ttl
+end
+
+local function dispatch(data)
+    if #data < 12 then
+        return
+    end
+    local q = _query[sunpack('>I2', data)]
+    if not q then
+        return
+    end
+    local ok, addrs, ttl = pcall(unpack_answer, q, data)
+    if not ok then
+        addrs, ttl = nil, addrs
+    end
+    _query[q.id] = nil
+    shaco.cancel(q.timer)
+    q.addrs = addrs
+    q.err = ttl
+    if addrs then
+        q.ttl = ttl
+        q.err = nil
+    end
+    shaco.wakeup(q.co)
+end
+
+local function open()
+    if not _id then
+        if not _server then
+            load_conf()
+        end
+        local id = socket.udp(dispatch)
+        if not id then
+            return nil, 'Open udp error'
+        end
+        if not socket.udp_connect(id, _server) then
+            socket.close(id)
+            return nil, 'Connect '.._server..' error'
+        end
+        _id = id
+    end
+    return _id
+end
+
+local function gen_id()
+    for i=1, 100 do
+        local id = random(0, 0xffff)
+        if not _query[id] then
+            return id
+        end
+    end
+end
+
+-- one query until answer or timeout, return addrs, ttl or nil, error
+local function query(name, qtype)
+    local id, err = open()
+    if not id then
+        return nil, err
+    end
+    local qid = gen_id()
+    if not qid then
+        return nil, 'Too many query'
+    end
+    local q = {
+        id = qid,
+        name = name,
+        qtype = qtype,
+        co = coroutine.running(),
+    }
+    _query[qid] = q
+    q.timer = shaco.timeout(_timeout, function()
+        if _query[qid] == q then
+            _query[qid] = nil
+            q.err = 'Timeout'
+            shaco.wakeup(q.co)
+        end
+    end)
+    socket.send(id, pack_question(qid, name, qtype))
+    shaco.wait()
+    if q.addrs then
+        return q.addrs, q.ttl
+    else
+        return nil, q.err
+    end
+end
+
+local function resolve(name, qtype)
+    local key = name..qtype
+    local c = _cache[key]
+    if c then
+        if c.expire > shaco.now() then
+            return c.addrs, c.err
+        end
+        _cache[key] = nil
+    end
+    local w = _waiting[key]
+    if w then
+        tinsert(w, (coroutine.running()))
+        shaco.wait()
+        return w.addrs, w.err
+    end
+    w = {}
+    _waiting[key] = w
+    local addrs, ttl
+    for i=1, _retry do
+        addrs, ttl = query(name, qtype)
+        if addrs or ttl ~= 'Timeout' then
+            break
+        end
+    end
+    _waiting[key] = nil
+    if addrs then
+        w.addrs = addrs
+        if ttl > 0 then
+            _cache[key] = { expire = shaco.now()+ttl*1000, addrs = addrs }
+        end
+    else
+        w.err = ttl
+        if ttl == 'No address' then
+            _cache[key] = { expire = shaco.now()+NODATA_TTL*1000, err = ttl }
+        end
+    end
+    for i=1, #w do
+        shaco.wakeup(w[i])
+    end
+    return w.addrs, w.err
+end
+
+-- set the name server ("ip:port" or ip, port), timeout for a query (ms),
+-- retry times when timeout, the default is the first nameserver in
+-- /etc/resolv.conf
+function dns.server(addr, port, timeout, retry)
+    if port then
+        addr = addr..':'..port
+    end
+    if _id then
+        socket.close(_id)
+        _id = false
+    end
+    _server = addr
+    _timeout = timeout or _timeout
+    _retry = retry or _retry
+end
+
+-- set the search domains and the ndots, the name has dots less than
+-- ndots try the name in every search domain before itself, the default
+-- is by /etc/resolv.conf
+function dns.search(domains, ndots)
+    _search = {}
+    for i=1, #domains do
+        _search[i] = slower((domains[i]:gsub('%.$', '')))
+    end
+    _ndots = ndots or _ndots
+end
+
+-- return true if the host is ip address, need not resolve
+function dns.isip(host)
+    return smatch(host, '^[%d%.]+$') ~= nil or
+        (smatch(host, '^[%x:%.]+$') ~= nil and host:find(':', 1, true) ~= nil)
+end
+
+-- /etc/hosts first, then the name server
+local function lookup(name, qtype)
+    local addrs = _hosts[name..qtype]
+    if addrs then
+        return addrs
+    end
+    return resolve(name, qtype)
+end
+
+-- the A record, the AAAA record if the name has no A record
+local function lookup_any(name, ipv6)
+    if ipv6 then
+        return lookup(name, QTYPE_AAAA)
+    end
+    local addrs, err = lookup(name, QTYPE_A)
+    if not addrs and err == 'No address' then
+        addrs, err = lookup(name, QTYPE_AAAA)
+    end
+    return addrs, err
+end
+
+-- return the first address and all addresses of the name, or nil, error,
+-- block the current coroutine only, ipv6 for the AAAA record only, else
+-- the A record and the AAAA record if no A record
+function dns.resolve(name, ipv6)
+    if dns.isip(name) then
+        return name, {name}
+    end
+    name = slower(name)
+    if not _hosts then
+        load_hosts()
+    end
+    if not _search then
+        load_conf()
+    end
+    local addrs, err
+    local absolute = name:sub(-1) == '.'
+    if absolute then
+        name = name:sub(1, -2)
+    else
+        local _, ndots = name:gsub('%.', '')
+        if ndots < _ndots then
+            for i=1, #_search do
+                addrs = lookup_any(name..'.'.._search[i], ipv6)
+                if addrs then
+                    return addrs[1], addrs
+                end
+            end
+        end
+    end
+    addrs, err = lookup_any(name, ipv6)
+    if not addrs then
+        return nil, sformat('Resolve %s: %s', name, err)
+    end
+    return addrs[1], addrs
+end
+
+-- clear the cache
+function dns.flush()
+    _cache = {}
+    _hosts = nil
+end
+
+return dns
@@ -11,6 +11,7 @@ local connection = {}
 local listen_id = false
 local rlimit
 local slimit
+local readlimit
 local maxclient = 0
 local client_number = 0
 local gateserver = {}
@@ -68,20 +69,21 @@ function gateserver.start(handle)
             socket.drop(data, size)
             return
         end
+        -- return the pack or nil, and the size left in buffer
         local function poppack(c)
             if c.head == false then
-                local head = c.buffer:pop(2)
+                local head, left = c.buffer:pop(2)
                 if head == nil then
-                    return
+                    return nil, left
                 end
                 --c.head = sunpack('>I2', head)
                 c.head = sunpack('<I2', head)
             end
-            local pack = c.buffer:pop(c.head)
+            local pack, left = c.buffer:pop(c.head)
             if pack then
                 c.head = false
-                return pack
             end
+            return pack, left
         end
         size = c.buffer:push(data, size)
         if size > rlimit then
@@ -89,15 +91,21 @@ function gateserver.start(handle)
             disconnect(id, true, "readbuffer")
             return
         end
+        local left = size
         while true do
-            local pack = poppack(c)
+            local pack
+            pack, left = poppack(c)
             if pack then
                 if handle_message(id, pack) then
                     disconnect(id, true, "message")
-                    break
+                    return
                 end
             else break end
         end
+        -- resume the read paused by readlimit
+        if readlimit and size > left then
+            socket.consumed(id, size-left)
+        end
     end
 
     -- SOCKET_TYPE_ACCEPT
@@ -110,6 +118,9 @@ function gateserver.start(handle)
             end
         end
         connection[id] = { buffer = socketbuffer_new(), head = false }
+        if readlimit then
+            socket.readlimit(id, readlimit)
+        end
         client_number = client_number + 1
         handle_connect(id, addr)
     end
@@ -138,6 +149,8 @@ function gateserver.start(handle)
         maxclient = conf.maxclient or 1024
         rlimit = conf.rlimit or 64*1024
         slimit = conf.slimit or 64*1024
+        -- pause the read instead of disconnect, should be less than rlimit
+        readlimit = conf.readlimit
         assert(rlimit > 0, "Invalid rlimit")
         assert(slimit > 0, "Invalid slimit")
         if handle.open then
@@ -0,0 +1,67 @@
+local shaco = require "shaco"
+local c = require "shaco.c"
+local tostring = tostring
+local tonumber = tonumber
+local assert = assert
+local pcall = pcall
+local error = error
+
+local c_shared = assert(c.shared)
+local c_sharedfree = assert(c.sharedfree)
+local c_publish = assert(c.publish)
+
+-- local channel, publish pack once and every subscriber share the payload
+local multicast = {}
+
+local _dispatch = {}
+
+function multicast.create()
+    return assert(tonumber(shaco.command('MCREATE')))
+end
+
+function multicast.delete(id)
+    _dispatch[id] = nil
+    local err = shaco.command('MDELETE', tostring(id))
+    if err then
+        error(err)
+    end
+end
+
+-- func(source, ...) is called for every message of the channel
+function multicast.subscribe(id, func)
+    local err = shaco.command('MSUB', tostring(id))
+    if err then
+        error(err)
+    end
+    _dispatch[id] = func
+end
+
+function multicast.unsubscribe(id)
+    _dispatch[id] = nil
+    shaco.command('MUNSUB', tostring(id))
+end
+
+-- return the delivered count
+function multicast.publish(id, ...)
+    local msg, sz = c_shared(shaco.pack(id, ...))
+    local ok, n = pcall(c_publish, id, msg, sz)
+    c_sharedfree(msg)
+    if not ok then
+        error(n)
+    end
+    return n
+end
+
+shaco.register_protocol {
+    id = shaco.TMULTICAST,
+    name = "multicast",
+    unpack = shaco.unpack,
+    dispatch = function(source, session, id, ...)
+        local f = _dispatch[id]
+        if f then
+            f(source, ...)
+        end
+    end,
+}
+
+return multicast
@@ -36,6 +36,37 @@ local function run_worker(channel, handler)
     end
 end
 
+-- reuseport mode, the worker accept on its own listener, then give the
+-- client fd and the result back to master for master_handler
+local function run_listener(conf, channel)
+    local handler = conf.worker_handler
+    local master_handler = conf.master_handler
+    assert(socket.listen(conf.address, function(id)
+        socket.start(id)
+        shaco.trace(sformat('Sock %d accept', id))
+        local ok, err = pcall(function()
+            local function response(ok, err, ...)
+                if not ok then
+                    error(err)
+                end
+                if master_handler then
+                    local fd = socket.getfd(id)
+                    if fd < 0 then
+                        error(sformat('Sock %d closed', id))
+                    end
+                    local ret = shaco.packstring(err, ...)
+                    channel.sendfd(fd, spack('s2', ret))
+                end
+            end
+            response(pcall(handler, id))
+        end)
+        socket.close(id)
+        if not ok then
+            shaco.error(err)
+        end
+    end, true))
+end
+
 local function worker_channel(fd)
     local channel = assert(socket.bind(fd, 'IPC'))
     socket.readon(channel)
@@ -43,7 +74,7 @@ local function worker_channel(fd)
     local function readfd()
         local fd, err = socket.ipc_readfd(channel)
         if not fd then
-            shaco.error('Channel readfd error: '..err)
+            shaco.error('Channel readfd error: '..tostring(err))
             os.exit(1)
         end
         return fd
@@ -51,13 +82,21 @@ local function worker_channel(fd)
     local function send(...)
         local ok, err = socket.ipc_send(channel, ...)
         if not ok then
-            shaco.error('Channel send error: '..err)
+            shaco.error('Channel send error: '..tostring(err))
+            os.exit(1)
+        end
+    end
+    local function sendfd(fd, ...)
+        local ok, err = socket.ipc_sendfd(channel, fd, ...)
+        if not ok then
+            shaco.error('Channel sendfd error: '..tostring(err))
             os.exit(1)
         end
     end
     return { 
         readfd = readfd, 
-        send = send 
+        send = send,
+        sendfd = sendfd,
     }
 end
 
@@ -76,6 +115,59 @@ local function master_channel(fd)
     return channel
 end
 
+-- reuseport mode, read the client fd and the result given by worker,
+-- the reader not run yet is inherited by the next forked worker, which
+-- close the channel then reuse the socket id by socket.reinit, so it
+-- check closed before every socket call
+local function master_reader(fd, name, handler)
+    local id, err = socket.bind(fd, 'IPC')
+    if not id then
+        socket.closefd(fd)
+        error(err)
+    end
+    socket.readon(id)
+    local closed = false
+    shaco.fork(function()
+        while not closed do
+            local client_fd, head = socket.ipc_readfd(id, 2)
+            if not client_fd or closed then
+                if client_fd then
+                    socket.closefd(client_fd)
+                end
+                break
+            end
+            local ret = socket.ipc_read(id, sunpack('I2', head))
+            if not ret or closed then
+                socket.closefd(client_fd)
+                break
+            end
+            local cid = socket.bind(client_fd)
+            if not cid then
+                socket.closefd(client_fd)
+            else
+                shaco.fork(function()
+                    local ok, err = pcall(handler, cid, name, shaco.unpackstring(ret))
+                    socket.close(cid)
+                    if not ok then
+                        shaco.error(err)
+                    end
+                end)
+            end
+        end
+        if not closed then
+            socket.close(id)
+        end
+    end)
+    return { 
+        close = function()
+            if not closed then
+                closed = true
+                socket.close(id)
+            end
+        end 
+    }
+end
+
 local function fork_worker(conf, index)
     local fd0, fd1, pid
     local ok, err = pcall(function()
@@ -111,7 +203,11 @@ local function fork_worker(conf, index)
                 conf.worker_init()
             end
             local channel = worker_channel(fd1)
-            shaco.fork(run_worker, channel, conf.worker_handler)
+            if conf.reuseport then
+                run_listener(conf, channel)
+            else
+                shaco.fork(run_worker, channel, conf.worker_handler)
+            end
             shaco.info(sformat('Worker %d:%d start', index, process.getpid()))
         end)
         if not ok then
@@ -123,11 +219,18 @@ local function fork_worker(conf, index)
         local ok, w = pcall(function()
             socket.closefd(fd1)
             process.settitle('master process')
+            local name = tostring(index)..':'..pid
+            local channel
+            if conf.reuseport then
+                channel = master_reader(fd0, name, conf.master_handler)
+            else
+                channel = master_channel(fd0)
+            end
             return {
-                name = tostring(index)..':'..pid,
+                name = name,
                 index = index,
                 pid = pid,
-                channel = master_channel(fd0),
+                channel = channel,
                 status = 'ok',
             }
         end)
@@ -201,7 +304,7 @@ local function start_listen(conf)
                     function(channel)
                         local head = channel:ipc_read(2)
                         head = sunpack('I2', head)
-                        return channel:ipc_read(head)
+                        return true, channel:ipc_read(head)
                     end))
             end)
             socket.close(id)
@@ -215,6 +318,9 @@ end
 conf = {
     addr = listen address
     worker = worker number
+    reuseport = every worker listen the address by SO_REUSEPORT, and the
+        kernel balance the connection, else the master accept and relay
+        the connection to worker
     worker_handler = function(id),
     master_handler = function(id, worker, ...),
         id: socket id
@@ -225,6 +331,10 @@ conf = {
 ]]
 local function mworker(conf)
     conf.worker = conf.worker or 1
+    if conf.reuseport and not socket.reuseport then
+        shaco.warn('SO_REUSEPORT is not supported, relay by master')
+        conf.reuseport = false
+    end
     shaco.start(function()
         signal.signal(signal.SIGCHLD, 
             function(sig, pid, reason, code, extra)
@@ -245,7 +355,11 @@ local function mworker(conf)
         if conf.master_init then
             conf.master_init()
         end
-        start_listen(conf)
+        if conf.reuseport then
+            shaco.info('Listen on '..conf.address..' by workers')
+        else
+            start_listen(conf)
+        end
         if prefork_workers(conf) ~= 'child' then
             shaco.fork(function()
                 while true do
@@ -5,7 +5,9 @@ local pairs = pairs
 local ipairs = ipairs
 local tostring = tostring
 local tonumber = tonumber
+local type = type
 local assert = assert
+local pcall = pcall
 local sformat = string.format
 local tunpack = table.unpack
 local tremove = table.remove
@@ -15,22 +17,35 @@ local cocreate = coroutine.create
 local coresume = coroutine.resume
 local coyield = coroutine.yield
 local corunning = coroutine.running
+local costatus = coroutine.status
 local traceback = debug.traceback
 
 local c_log = assert(c.log)
 local c_send = assert(c.send)
 local c_timer = assert(c.timer)
+local c_utimer = assert(c.utimer)
+local c_untimer = assert(c.untimer)
+local c_query = assert(c.query)
+local c_nameversion = assert(c.nameversion)
+local c_shared = assert(c.shared)
+local c_sharedfree = assert(c.sharedfree)
 
 local _co_pool = setmetatable({}, { __mode = "kv" })
 local _call_session = {}
 local _yield_session_co = {}
 local _sleep_co = {}
+local _timer_session = {} -- session -> timer id
+local _tick_id = {} -- session -> repeat timer id
+local _tick_co = {} -- session -> coroutine, false if wait the end
 local _response_co_session = {}
 local _response_co_address = {}
 
 local _session_id = 0
 local _fork_queue = {}
 local _wakeup_co = {}
+-- name -> handle, drop all when the name registry change
+local _name_cache = {}
+local _name_version = -1
 
 -- proto type
 local proto = {}
@@ -45,6 +60,7 @@ local shaco = {
     TTIME = 8,
     --TREMOTE = 9,
     TERROR = 10,
+    TMULTICAST = 11,
     UM = 20,
 }
 
@@ -71,6 +87,8 @@ shaco.trace   = function(...) log(LOG_TRACE, ...) end
 shaco.debug   = function(...) log(LOG_DEBUG, ...) end
 
 shaco.now = assert(c.now)
+shaco.now_us = assert(c.now_us)
+shaco.mqstat = assert(c.mqstat)
 shaco.command = assert(c.command)
 shaco.handle = assert(c.handle)
 shaco.tobytes = assert(c.tobytes)
@@ -110,13 +128,50 @@ local function co_create(func)
     return co
 end
 
+-- no found keep the name, c_send report it
+local function todest(dest)
+    if type(dest) ~= 'string' then
+        return dest
+    end
+    local version = c_nameversion()
+    if version ~= _name_version then
+        _name_cache = {}
+        _name_version = version
+    end
+    local handle = _name_cache[dest]
+    if handle == nil then
+        handle = c_query(dest)
+        if handle == nil then
+            return dest
+        end
+        _name_cache[dest] = handle
+    end
+    return handle
+end
+
 function shaco.send(dest, typename, ...)
     local p = proto[typename]
-    return c_send(dest, 0, p.id, p.pack(...))
+    return c_send(todest(dest), 0, p.id, p.pack(...))
+end
+
+-- pack once, all the dests share one payload
+function shaco.broadcast(dests, typename, ...)
+    local p = proto[typename]
+    local msg, sz = c_shared(p.pack(...))
+    local ok, err = pcall(function()
+        for i=1, #dests do
+            c_send(todest(dests[i]), 0, p.id, msg, sz, true)
+        end
+    end)
+    c_sharedfree(msg)
+    if not ok then
+        error(err)
+    end
 end
 
 function shaco.call(dest, typename, ...)
     local p = proto[typename]
+    dest = todest(dest)
     local session = gen_session()
     if not c_send(dest, session, p.id, p.pack(...)) then
         error('call error')
@@ -140,6 +195,41 @@ function shaco.response(pack)
     return coyield('RESPONSE', pack)
 end
 
+-- return true if nothing will come for the session,
+-- false if the timer is expired and the message is on the way
+local function cancel_timer(session)
+    local id = _timer_session[session]
+    if id then
+        _timer_session[session] = nil
+        return c_untimer(id)
+    end
+    return true
+end
+
+local function cancel_tick(session)
+    local id = _tick_id[session]
+    _tick_id[session] = nil
+    if c_untimer(id) then
+        _tick_co[session] = false -- wait the end
+    else
+        _tick_co[session] = nil -- it is gone already
+    end
+end
+
+local function dispatch_tick(session, co, sz)
+    if sz < 0 then -- the end after cancel
+        _tick_co[session] = nil
+    elseif co then
+        if _yield_session_co[session] == co then
+            _yield_session_co[session] = nil
+            suspend(co, coresume(co, true))
+        elseif costatus(co) == 'dead' then -- error in tick func
+            cancel_tick(session)
+        end
+        -- else the last tick is still running, skip this one
+    end
+end
+
 local function dispatch_wakeup()
     local co = next(_wakeup_co)
     if co then
@@ -147,7 +237,11 @@ local function dispatch_wakeup()
         local session = _sleep_co[co]
         if session then
             -- _yield_session_co if tag _sleep_co can break by wakeup
-            _yield_session_co[session] = 'BREAK' 
+            if cancel_timer(session) then
+                _yield_session_co[session] = nil
+            else
+                _yield_session_co[session] = 'BREAK' 
+            end
             return suspend(co, coresume(co, false, 'BREAK'))
         end
     end
@@ -167,6 +261,8 @@ function suspend(co, result, command, param, sz)
     if command == 'SLEEP' then
         _yield_session_co[param] = co
         _sleep_co[co] = param
+    elseif command == 'TICK' then
+        _yield_session_co[param] = co
     elseif command == 'CALL' then
         _call_session[param] = true
         _yield_session_co[param] = co
@@ -216,6 +312,13 @@ end
 local function dispatch_message(source, session, typeid, msg, sz)
     if typeid == 8 or -- shaco.TTIME
        typeid == 6 then -- shaco.TRESPONSE 
+        if typeid == 8 then
+            _timer_session[session] = nil
+            local tick = _tick_co[session]
+            if tick ~= nil then
+                return dispatch_tick(session, tick, sz)
+            end
+        end
         local co = _yield_session_co[session] 
         if co == 'BREAK' then -- BREAK by wakeup yet
             _yield_session_co[session] = nil 
@@ -304,9 +407,8 @@ function shaco.wait()
     _yield_session_co[session] = nil
 end
 
-function shaco.sleep(interval)
-    local session = gen_session()
-    c_timer(session, interval)
+local function sleep(session, id)
+    _timer_session[session] = id
     local ok, ret = coyield('SLEEP', session)
     _sleep_co[corunning()] = nil
     if ok then
@@ -320,12 +422,71 @@ function shaco.sleep(interval)
     end
 end
 
+-- shaco.wakeup the coroutine to break the sleep, the timer is cancelled
+function shaco.sleep(interval)
+    local session = gen_session()
+    return sleep(session, c_timer(session, interval))
+end
+
+-- usec, need hrtimer=1, or round up to msec
+function shaco.usleep(usec)
+    local session = gen_session()
+    return sleep(session, c_utimer(session, usec))
+end
+
 function shaco.timeout(interval, func)
     local co = co_create(func)
     local session = gen_session()
     assert(_yield_session_co[session] == nil, 'Repeat session '..session)
     _yield_session_co[session] = co
-    c_timer(session, interval)
+    _timer_session[session] = c_timer(session, interval)
+    return session
+end
+
+-- call func every interval in one coroutine, the timer is re-armed in C
+-- without drift, a tick is skipped if the last one is still running,
+-- return the handle for shaco.cancel
+function shaco.tick(interval, func)
+    assert(interval > 0, 'Tick interval must > 0')
+    local session = gen_session()
+    local co = co_create(function()
+        while _tick_id[session] do
+            func()
+            if not _tick_id[session] then
+                break
+            end
+            coyield('TICK', session)
+        end
+    end)
+    _tick_id[session] = c_timer(session, interval, true)
+    _tick_co[session] = co
+    _yield_session_co[session] = co
+    return session
+end
+
+-- cancel the shaco.timeout or shaco.tick, return false if the timeout
+-- func has run already
+function shaco.cancel(session)
+    if _tick_id[session] then
+        local co = _tick_co[session]
+        cancel_tick(session)
+        if _yield_session_co[session] == co then
+            -- wait the next tick, let it exit
+            _yield_session_co[session] = nil
+            tinsert(_fork_queue, co)
+        end
+        return true
+    end
+    local co = _yield_session_co[session]
+    if co == nil or co == 'BREAK' or _sleep_co[co] then
+        return false
+    end
+    if cancel_timer(session) then
+        _yield_session_co[session] = nil
+    else
+        _yield_session_co[session] = 'BREAK'
+    end
+    return true
 end
 
 function shaco.dispatch(protoname, fun)
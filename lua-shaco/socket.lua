@@ -4,6 +4,7 @@ local socketbuffer = require "socketbuffer.c"
 local co_running = coroutine.running
 local sformat = string.format
 local sunpack = string.unpack
+local smatch = string.match
 local assert = assert
 local type = type
 local tonumber = tonumber
@@ -22,11 +23,24 @@ local c_unpack = assert(c.unpack)
 local c_readon = assert(c.readon)
 local c_readoff = assert(c.readoff)
 local c_drop = assert(c.drop)
+local c_udp = assert(c.udp)
+local c_udpconnect = assert(c.udpconnect)
+local c_sendto = assert(c.sendto)
+local c_watermark = assert(c.watermark)
+local c_readlimit = assert(c.readlimit)
+local c_zerocopy = assert(c.zerocopy)
+local c_consumed = assert(c.consumed)
 local socketbuffer_new = assert(socketbuffer.new)
 socket.getfd = assert(c.getfd)
 socket.pair = assert(c.pair)
 socket.closefd = assert(c.closefd)
+socket.rbufstat = assert(c.rbufstat)
+socket.stat = assert(c.stat) -- (id), the io stat with the tcp rtt
+socket.top = assert(c.top) -- ([n], [by]), the top n stats, see command.socktop
+socket.udp_address = assert(c.udpaddress)
+socket.consumed = c_consumed -- for the reader has own buffer, see socket.readlimit
 socket.error = assert(__error)
+socket.reuseport = c.reuseport -- SO_REUSEPORT supported
 
 local socket_pool = {}
 
@@ -44,6 +58,17 @@ local function wakeup(s)
     end
 end
 
+-- the coroutine wait in socket.writable
+local function wakeup_writer(s)
+    local wco = s.wco
+    if wco then
+        s.wco = nil
+        for i=1, #wco do
+            shaco.wakeup(wco[i])
+        end
+    end
+end
+
 local function close(s, force)
     if s then
         local id = s.id
@@ -51,6 +76,7 @@ local function close(s, force)
             c_close(id, force)
             s.connected = false
         end
+        wakeup_writer(s)
         if s.co then
             wakeup(s)
         else
@@ -70,6 +96,9 @@ event[0] = function(id, data, size)
         return
     end
     size = s.buffer:push(data, size)
+    if s.rhigh then
+        s.rsize = size
+    end
     if s.rlimit and size > s.rlimit then
         shaco.error(sformat('Socket %d read buffer too large %d', id, size))
         c_close(id, true)
@@ -125,6 +154,32 @@ event[4] = function(id)
     if s then
         s.connected = false
         wakeup(s)
+        wakeup_writer(s)
+    end
+end
+
+-- SOCKET_TYPE_UDP
+event[6] = function(id, data, from)
+    local s = socket_pool[id]
+    if s then
+        s.callback(data, from)
+    end
+end
+
+-- SOCKET_TYPE_BLOCKED
+event[7] = function(id)
+    local s = socket_pool[id]
+    if s then
+        s.blocked = true
+    end
+end
+
+-- SOCKET_TYPE_WRITABLE
+event[8] = function(id)
+    local s = socket_pool[id]
+    if s then
+        s.blocked = false
+        wakeup_writer(s)
     end
 end
 
@@ -173,8 +228,40 @@ function socket.detachbuffer(id)
     end
 end
 
-function socket.listen(addr, callback)
-    local id = c_listen(addr)
+-- resolve the host name by dns before call c, so getaddrinfo never block,
+-- ("host:port") or (host, port), return ip, port or nil,
+-- the unix address ("unix:/path" or "unixpacket:/path") is kept as is
+local dns
+local function resolve(host, port)
+    if smatch(host, '^unix:') or smatch(host, '^unixpacket:') then
+        return host, 0
+    end
+    if port == nil then
+        local h, p = smatch(host, '^(.*):(%d+)$')
+        if not h then
+            error('Invalid address '..host)
+        end
+        host, port = h, tonumber(p)
+    end
+    dns = dns or require "dns"
+    if dns.isip(host) then
+        return host, port
+    end
+    local ip, err = dns.resolve(host)
+    if not ip then
+        shaco.error(err)
+        return
+    end
+    return ip, port
+end
+
+-- reuseport: listen the port shared with the other process
+function socket.listen(addr, callback, reuseport)
+    local ip, port = resolve(addr)
+    if not ip then
+        return nil
+    end
+    local id = c_listen(ip, port, reuseport)
     if id then
         local s = alloc(id, callback)
         s.connected = true
@@ -182,8 +269,13 @@ function socket.listen(addr, callback)
     return id
 end
 
+-- the host name is resolved by dns, see dns.lua
 function socket.connect(...)
-    local id, conning = c_connect(...)
+    local ip, port = resolve(...)
+    if not ip then
+        return nil
+    end
+    local id, conning = c_connect(ip, port)
     if id then
         local s = alloc(id)
         if conning then 
@@ -195,12 +287,42 @@ function socket.connect(...)
                 return nil
             end
         end
+        -- connected at once, always for the unix socket
+        s.connected = true
         return id
     else 
         return nil
     end
 end
 
+-- udp socket, callback(data, from) for every datagram, do not block in it,
+-- from is the source address for socket.sendto, see socket.udp_address,
+-- bind the address ("ip:port", or ip, port) if given
+function socket.udp(callback, ...)
+    local id = c_udp(...)
+    if id then
+        local s = alloc(id, callback)
+        s.connected = true
+        c_readon(id)
+    end
+    return id
+end
+
+-- the default dest for socket.send, and recv from it only
+function socket.udp_connect(id, ...)
+    return c_udpconnect(id, ...)
+end
+
+function socket.sendto(id, from, data, i, j)
+    local s = socket_pool[id]
+    if s and s.connected then
+        if c_sendto(id, from, data, i, j) then
+            return true
+        end
+    end
+    return nil, __error
+end
+
 -- wrap a exist fd to socket
 function socket.bind(fd, protocol)
     if protocol == 'IPC' then
@@ -257,18 +379,28 @@ function socket.block(id)
     return s.connected
 end
 
+-- report the consumed to resume the read paused by socket.readlimit
+local function pop(s, format)
+    local data, size = s.buffer:pop(format)
+    if s.rhigh and data then
+        c_consumed(s.id, s.rsize - size)
+        s.rsize = size
+    end
+    return data
+end
+
 function socket.read(id, format)
     local s = socket_pool[id]
     format = format or false
     s.read_format = format
-    local data = s.buffer:pop(format)
+    local data = pop(s, format)
     if data then
         return data
     else -- check connected first 
         if s.connected then 
             suspend(s)
             if s.connected then
-                return s.buffer:pop(format)
+                return pop(s, format)
             end
         end
         socket_pool[id] = nil
@@ -281,6 +413,10 @@ function socket.send(id, data, i, j)
     if s.connected then
         local size = c_send(id, data, i, j)
         if size then
+            -- blocked now, the event BLOCKED come later
+            if s.whigh and size >= s.whigh then
+                s.blocked = true
+            end
             if s.slimit and size > s.slimit then
                 shaco.error(sformat('Socket %d send buffer too large %d', id, size))
                 c_close(id)
@@ -311,7 +447,7 @@ function socket.ipc_readfd(id, format)
     else
         fd = socket.read(id, 4)
         if fd then
-            data = socket.read(id, format)
+            local data = socket.read(id, format)
             if data then
                 fd = sunpack('=i', fd)
                 return fd, data
@@ -353,6 +489,77 @@ function socket.ipc_send(id, data, i, j)
     return nil, __error
 end
 
+-- the send buffer watermark, the socket is blocked when the buffer grow
+-- up to high, until it drop to low (default high/2), high 0 to disable
+function socket.watermark(id, high, low)
+    local s = socket_pool[id]
+    assert(s)
+    if not c_watermark(id, high, low) then
+        return nil, __error
+    end
+    if high > 0 then
+        s.whigh = high
+    else
+        s.whigh = nil
+        s.blocked = false
+        wakeup_writer(s)
+    end
+    return true
+end
+
+function socket.blocked(id)
+    local s = socket_pool[id]
+    return s ~= nil and s.blocked == true
+end
+
+-- wait until the socket is not blocked, see socket.watermark,
+-- return nil if the socket is closed
+function socket.writable(id)
+    local s = socket_pool[id]
+    if s == nil then
+        return nil, __error
+    end
+    while s.blocked and s.connected do
+        local wco = s.wco
+        if not wco then
+            wco = {}
+            s.wco = wco
+        end
+        wco[#wco+1] = co_running()
+        shaco.wait()
+    end
+    if s.connected then
+        return true
+    end
+    return nil, __error
+end
+
+-- pause the read when the data read but not consumed grow up to high,
+-- until it drop to low (default high/2), then the peer is throttled by
+-- the tcp flow control, high 0 to disable, the reader not by socket.read
+-- should report by socket.consumed(id, size)
+function socket.readlimit(id, high, low)
+    if not c_readlimit(id, high, low) then
+        return nil, __error
+    end
+    local s = socket_pool[id]
+    if s then
+        s.rhigh = high > 0 and high or nil
+        s.rsize = 0
+    end
+    return true
+end
+
+-- send the message not less than threshold bytes without the copy in the
+-- kernel (MSG_ZEROCOPY, linux 4.14+), for the large one, eg. 64KB up,
+-- 0 to disable, it is stopped if the kernel copy it anyway (eg. loopback)
+function socket.zerocopy(id, threshold)
+    if not c_zerocopy(id, threshold) then
+        return nil, __error
+    end
+    return true
+end
+
 function socket.limit(id, rlimit, slimit)
     local s = socket_pool[id]
     s.rlimit = rlimit
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <lstate.h>
 #include "shaco.h"
+#include "shaco_multicast.h"
 static int _TRACE=0;
 static int                                        
 _traceback(lua_State *L) {                        
@@ -52,6 +53,43 @@ lnow(lua_State *L) {
     return 1;
 }
 
+static int
+lnow_us(lua_State *L) {
+    pushnumint(L, shaco_timer_now_us());
+    return 1;
+}
+
+static void
+_mqstat(struct shaco_context *ctx, void *ud) {
+    lua_State *L = ud;
+    lua_pushinteger(L, shaco_context_mqlen(ctx));
+    lua_rawseti(L, -2, shaco_context_handle(ctx));
+}
+
+static int
+lmqstat(lua_State *L) {
+    lua_newtable(L);
+    shaco_handle_foreach(_mqstat, L);
+    return 1;
+}
+
+static int
+lquery(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+    if (name[0]=='.') name++;
+    uint32_t handle = shaco_handle_query(name);
+    if (handle == 0)
+        return 0;
+    lua_pushinteger(L, handle);
+    return 1;
+}
+
+static int
+lnameversion(lua_State *L) {
+    lua_pushinteger(L, shaco_handle_version());
+    return 1;
+}
+
 static int
 lsend(lua_State *L) {
     struct shaco_context *ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -63,7 +101,7 @@ lsend(lua_State *L) {
     if (isptr) { 
         msg = lua_touserdata(L, 4);
         sz = luaL_checkinteger(L, 5);
-        type |= SHACO_DONT_COPY;
+        type |= lua_toboolean(L, 6) ? SHACO_SHARED : SHACO_DONT_COPY;
     } else {
         msg = (void*)luaL_checklstring(L, 4, &sz);
     }
@@ -74,7 +112,7 @@ lsend(lua_State *L) {
         // todo: remote query
         dest = shaco_handle_query(name);
         if (dest == 0) {
-            if (isptr) shaco_free(msg);
+            if (isptr && !(type & SHACO_SHARED)) shaco_free(msg);
             return luaL_error(L, "Not dest `%s`", name);
         }
     }
@@ -87,14 +125,53 @@ lsend(lua_State *L) {
     return 1;
 }
 
+// publish shared payload to channel, return the delivered count
+static int
+lpublish(lua_State *L) {
+    struct shaco_context *ctx = lua_touserdata(L, lua_upvalueindex(1));
+    uint32_t id = luaL_checkinteger(L, 1);
+    luaL_checktype(L, 2, LUA_TLIGHTUSERDATA);
+    void *p = lua_touserdata(L, 2);
+    int sz = luaL_checkinteger(L, 3);
+    int n = shaco_multicast_publish(ctx, id, p, sz);
+    if (n < 0) {
+        return luaL_error(L, "No channel %d", (int)id);
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
 static int
 ltimer(lua_State *L) {
     struct shaco_context *ctx = lua_touserdata(L, lua_upvalueindex(1));
     uint32_t handle = shaco_context_handle(ctx);
     int session = luaL_checkinteger(L, 1);
     int interval = luaL_checkinteger(L, 2);
-    shaco_timer_register(handle, session, interval);
-    return 0;
+    uint64_t id;
+    if (lua_toboolean(L, 3))
+        id = shaco_timer_repeat(handle, session, interval);
+    else
+        id = shaco_timer_register(handle, session, interval);
+    lua_pushinteger(L, (lua_Integer)id);
+    return 1;
+}
+
+static int
+lutimer(lua_State *L) {
+    struct shaco_context *ctx = lua_touserdata(L, lua_upvalueindex(1));
+    uint32_t handle = shaco_context_handle(ctx);
+    int session = luaL_checkinteger(L, 1);
+    lua_Integer usec = luaL_checkinteger(L, 2);
+    uint64_t id = shaco_timer_register_us(handle, session, usec > 0 ? usec : 0);
+    lua_pushinteger(L, (lua_Integer)id);
+    return 1;
+}
+
+static int
+luntimer(lua_State *L) {
+    uint64_t id = (uint64_t)luaL_checkinteger(L, 1);
+    lua_pushboolean(L, id != 0 && shaco_timer_cancel(id) == 0);
+    return 1;
 }
 
 static int
@@ -175,6 +252,32 @@ ltobytes(lua_State *L) {
     return 2;
 }
 
+// copy to shared payload, the bytes is free, the caller hold one ref
+static int
+lshared(lua_State *L) {
+    void *p;
+    size_t sz;
+    if (lua_type(L,1) == LUA_TLIGHTUSERDATA) {
+        void *msg = lua_touserdata(L,1);
+        sz = luaL_checkinteger(L,2);
+        p = shaco_shared_create(msg, sz);
+        shaco_free(msg);
+    } else {
+        const char *s = luaL_checklstring(L,1,&sz);
+        p = shaco_shared_create(s, sz);
+    }
+    lua_pushlightuserdata(L,p);
+    lua_pushinteger(L,sz);
+    return 2;
+}
+
+static int
+lsharedfree(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+    shaco_shared_release(lua_touserdata(L,1));
+    return 0;
+}
+
 static int
 lfreebytes(lua_State *L) {
     luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
@@ -191,16 +294,25 @@ luaopen_shaco_c(lua_State *L) {
         { "log",            llog },
         { "send",           lsend },
         { "timer",          ltimer },
+        { "utimer",         lutimer },
+        { "untimer",        luntimer },
         { "callback",       lcallback },
         { "handle",         lhandle },
+        { "publish",        lpublish },
         { NULL, NULL},
 	}; 
     luaL_Reg l2[] = {
         { "now",            lnow },
+        { "now_us",         lnow_us },
+        { "mqstat",         lmqstat },
+        { "query",          lquery },
+        { "nameversion",    lnameversion },
         { "tostring",       ltostring },
         { "topointstring",  ltopointstring },
         { "tobytes",        ltobytes},
         { "freebytes",      lfreebytes},
+        { "shared",         lshared},
+        { "sharedfree",     lsharedfree},
         { NULL, NULL},
     };
 	luaL_newlibtable(L, l);
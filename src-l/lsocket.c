@@ -1,5 +1,6 @@
 #include "shaco.h"
 #include "shaco_socket.h"
+#include "shaco_rbuf.h"
 #include "socket_platform.h"
 #include <lua.h>
 #include <lauxlib.h>
@@ -29,27 +30,36 @@ lbind(lua_State *L) {
     }
 }
 
+static inline int
+isunix(const char *addr) {
+    return strncmp(addr, "unix:", 5) == 0 ||
+           strncmp(addr, "unixpacket:", 11) == 0;
+}
+
 static int
 llisten(lua_State *L) {
     struct shaco_context *ctx = lua_touserdata(L, lua_upvalueindex(1));
     int id;
-    if (lua_gettop(L) == 1) {
+    if (lua_type(L, 2) != LUA_TNUMBER) { // ("ip:port" [, reuseport])
         size_t sz;
         const char *ip = luaL_checklstring(L, 1, &sz);
         char tmp[sz+1];
         memcpy(tmp, ip, sz);
         tmp[sz] = '\0';
-        char *p = strchr(tmp, ':');
-        if (p == NULL) {
-            return luaL_error(L, "Invalid address %s", ip);
+        int port = 0;
+        if (!isunix(tmp)) { // "unix:/path" as is, no port
+            char *p = strchr(tmp, ':');
+            if (p == NULL) {
+                return luaL_error(L, "Invalid address %s", ip);
+            }
+            *p = '\0';
+            port = strtol(p+1, NULL, 10);
         }
-        *p = '\0';
-        int port = strtol(p+1, NULL, 10);
-        id = shaco_socket_listen(ctx, tmp, port);
+        id = shaco_socket_listen(ctx, tmp, port, lua_toboolean(L, 2));
     } else {
         const char *ip = luaL_checkstring(L, 1);
         int port = luaL_checkinteger(L, 2);
-        id = shaco_socket_listen(ctx, ip, port);
+        id = shaco_socket_listen(ctx, ip, port, lua_toboolean(L, 3));
     }
     if (id >= 0) { 
         lua_pushinteger(L, id); 
@@ -70,12 +80,15 @@ lconnect(lua_State *L) {
         char tmp[sz+1];
         memcpy(tmp, ip, sz);
         tmp[sz] = '\0';
-        char *p = strchr(tmp, ':');
-        if (p == NULL) {
-            return luaL_error(L, "Invalid address %s", ip);
+        int port = 0;
+        if (!isunix(tmp)) { // "unix:/path" as is, no port
+            char *p = strchr(tmp, ':');
+            if (p == NULL) {
+                return luaL_error(L, "Invalid address %s", ip);
+            }
+            *p = '\0';
+            port = strtol(p+1, NULL, 10);
         }
-        *p = '\0';
-        int port = strtol(p+1, NULL, 10);
         id = shaco_socket_connect(ctx, tmp, port, &conning);
     } else {
         const char *ip = luaL_checkstring(L, 1);
@@ -112,34 +125,62 @@ lpair(lua_State *L) {
     }
 }
 
-static int
-lsend(lua_State *L) {
-    int id = luaL_checkinteger(L,1);
+// the send data at index: lightuserdata, size or string, [start, end]
+static void *
+_tobuffer(lua_State *L, int index, int *sz) {
     void *msg;
-    int sz;
-    int type = lua_type(L,2);
+    int type = lua_type(L,index);
     switch (type) {
     case LUA_TLIGHTUSERDATA:
-        msg = lua_touserdata(L,2);
-        sz = luaL_checkinteger(L,3);
+        msg = lua_touserdata(L,index);
+        *sz = luaL_checkinteger(L,index+1);
         break;
     case LUA_TSTRING: {
         size_t l;
-        const char *s = luaL_checklstring(L,2,&l);
-        int start = luaL_optinteger(L, 3, 1);
-        int end = luaL_optinteger(L, 4, l);
+        const char *s = luaL_checklstring(L,index,&l);
+        int start = luaL_optinteger(L, index+1, 1);
+        int end = luaL_optinteger(L, index+2, l);
         if (start < 1) start = 1;
         if (end > l) end = l;
         if (start > end) {
-            return luaL_error(L, "send range error");
+            luaL_error(L, "send range error");
         }
-        sz = end-start+1;
-        msg = shaco_malloc(sz);
-        memcpy(msg, s+start-1, sz);
+        *sz = end-start+1;
+        msg = shaco_malloc(*sz);
+        memcpy(msg, s+start-1, *sz);
         break; }
     default:
-        return luaL_argerror(L, 2, "invalid type");
+        luaL_argerror(L, index, "invalid type");
+        return NULL;
+    }
+    return msg;
+}
+
+// "ip:port", or ip, port at the index
+static const char *
+_toaddress(lua_State *L, int index, char *tmp, size_t tmpsz, int *port) {
+    size_t sz;
+    const char *ip = luaL_checklstring(L, index, &sz);
+    if (!lua_isnoneornil(L, index+1)) {
+        *port = luaL_checkinteger(L, index+1);
+        return ip;
     }
+    char *p;
+    if (sz >= tmpsz ||
+        (p = strrchr(memcpy(tmp, ip, sz+1), ':')) == NULL) {
+        luaL_error(L, "Invalid address %s", ip);
+        return NULL;
+    }
+    *p = '\0';
+    *port = strtol(p+1, NULL, 10);
+    return tmp;
+}
+
+static int
+lsend(lua_State *L) {
+    int id = luaL_checkinteger(L,1);
+    int sz;
+    void *msg = _tobuffer(L, 2, &sz);
     int n = shaco_socket_send(id,msg,sz);
     if (n < 0) {
         lua_pushnil(L);
@@ -202,6 +243,72 @@ lsendfd(lua_State *L) {
     }
 }
 
+// udp socket, bind the address if given
+static int
+ludp(lua_State *L) {
+    struct shaco_context *ctx = lua_touserdata(L, lua_upvalueindex(1));
+    char tmp[256];
+    const char *ip = NULL;
+    int port = 0;
+    if (!lua_isnoneornil(L, 1))
+        ip = _toaddress(L, 1, tmp, sizeof(tmp), &port);
+    int id = shaco_socket_udp(ctx, ip, port);
+    if (id >= 0) {
+        lua_pushinteger(L, id);
+        return 1;
+    } else {
+        lua_pushnil(L);
+        return 1;
+    }
+}
+
+static int
+ludpconnect(lua_State *L) {
+    int id = luaL_checkinteger(L, 1);
+    char tmp[256];
+    int port;
+    const char *ip = _toaddress(L, 2, tmp, sizeof(tmp), &port);
+    lua_pushboolean(L, shaco_socket_udpconnect(id, ip, port) == 0);
+    return 1;
+}
+
+// send to the udp address, as the from of the udp message
+static int
+lsendto(lua_State *L) {
+    int id = luaL_checkinteger(L, 1);
+    size_t l;
+    const uint8_t *addr = (const uint8_t *)luaL_checklstring(L, 2, &l);
+    if (l == 0 || socket_udpaddrsz(addr) != l) {
+        return luaL_argerror(L, 2, "invalid udp address");
+    }
+    int sz;
+    void *msg = _tobuffer(L, 3, &sz);
+    int n = shaco_socket_udpsend(id, addr, msg, sz);
+    if (n < 0) {
+        lua_pushnil(L);
+        return 1;
+    } else {
+        lua_pushinteger(L, n);
+        return 1;
+    }
+}
+
+// return ip, port of the udp address
+static int
+ludpaddress(lua_State *L) {
+    size_t l;
+    const uint8_t *addr = (const uint8_t *)luaL_checklstring(L, 1, &l);
+    char ip[INET6_ADDRSTRLEN];
+    int port;
+    if (l == 0 || socket_udpaddrsz(addr) != l ||
+        socket_udpaddr(addr, ip, sizeof(ip), &port)) {
+        return luaL_argerror(L, 1, "invalid udp address");
+    }
+    lua_pushstring(L, ip);
+    lua_pushinteger(L, port);
+    return 2;
+}
+
 static int
 lreinit(lua_State *L) {
     shaco_socket_fini();
@@ -239,6 +346,44 @@ lreadoff(lua_State *L) {
     return 0;
 }
 
+// (id, high, low), high 0 to disable
+static int
+lwatermark(lua_State *L) {
+    int id = luaL_checkinteger(L, 1);
+    int high = luaL_checkinteger(L, 2);
+    int low = luaL_optinteger(L, 3, high/2);
+    lua_pushboolean(L, shaco_socket_watermark(id, high, low) == 0);
+    return 1;
+}
+
+// (id, high, low), high 0 to disable
+static int
+lreadlimit(lua_State *L) {
+    int id = luaL_checkinteger(L, 1);
+    int high = luaL_checkinteger(L, 2);
+    int low = luaL_optinteger(L, 3, high/2);
+    lua_pushboolean(L, shaco_socket_readlimit(id, high, low) == 0);
+    return 1;
+}
+
+// (id, threshold), threshold 0 to disable
+static int
+lzerocopy(lua_State *L) {
+    int id = luaL_checkinteger(L, 1);
+    int threshold = luaL_checkinteger(L, 2);
+    lua_pushboolean(L, shaco_socket_zerocopy(id, threshold) == 0);
+    return 1;
+}
+
+static int
+lconsumed(lua_State *L) {
+    int id = luaL_checkinteger(L, 1);
+    int size = luaL_checkinteger(L, 2);
+    if (size > 0)
+        shaco_socket_consumed(id, size);
+    return 0;
+}
+
 static int
 lgetfd(lua_State *L) {
     int id = luaL_checkinteger(L, 1);
@@ -250,10 +395,108 @@ static int
 ldrop(lua_State *L) {
     void *msg = lua_touserdata(L,1);
     luaL_checkinteger(L,2);
-    shaco_free(msg);
+    shaco_rbuf_free(msg);
     return 0;
 }
 
+static int
+lrbufstat(lua_State *L) {
+    struct shaco_rbuf_stat st;
+    shaco_rbuf_stat(&st);
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, st.hit);
+    lua_setfield(L, -2, "hit");
+    lua_pushinteger(L, st.miss);
+    lua_setfield(L, -2, "miss");
+    lua_pushinteger(L, st.recycle);
+    lua_setfield(L, -2, "recycle");
+    lua_pushinteger(L, st.drop);
+    lua_setfield(L, -2, "drop");
+    lua_pushinteger(L, st.cached);
+    lua_setfield(L, -2, "cached");
+    lua_pushinteger(L, st.cached_bytes);
+    lua_setfield(L, -2, "cached_bytes");
+    return 1;
+}
+
+static void
+pushstat(lua_State *L, struct socket_stat *st) {
+    lua_createtable(L, 0, 17);
+    lua_pushinteger(L, st->id);
+    lua_setfield(L, -2, "id");
+    lua_pushinteger(L, st->fd);
+    lua_setfield(L, -2, "fd");
+    lua_pushstring(L, st->protocol == SOCKET_PROTOCOL_UDP ? "udp" :
+                      st->protocol == SOCKET_PROTOCOL_IPC ? "ipc" : "tcp");
+    lua_setfield(L, -2, "protocol");
+    lua_pushinteger(L, st->rbytes);
+    lua_setfield(L, -2, "rbytes");
+    lua_pushinteger(L, st->wbytes);
+    lua_setfield(L, -2, "wbytes");
+    lua_pushinteger(L, st->rcount);
+    lua_setfield(L, -2, "rcount");
+    lua_pushinteger(L, st->wcount);
+    lua_setfield(L, -2, "wcount");
+    lua_pushinteger(L, st->sbuffersz);
+    lua_setfield(L, -2, "sbuffer");
+    lua_pushinteger(L, st->rpending);
+    lua_setfield(L, -2, "rpending");
+    lua_pushinteger(L, st->age);
+    lua_setfield(L, -2, "age");
+    lua_pushinteger(L, st->idle);
+    lua_setfield(L, -2, "idle");
+    lua_pushinteger(L, st->rate);
+    lua_setfield(L, -2, "rate");
+    if (st->zbytes > 0 || st->zcopied > 0) {
+        lua_pushinteger(L, st->zbytes);
+        lua_setfield(L, -2, "zbytes");
+        lua_pushinteger(L, st->zcopied);
+        lua_setfield(L, -2, "zcopied");
+    }
+    if (st->rtt >= 0) {
+        lua_pushinteger(L, st->rtt);
+        lua_setfield(L, -2, "rtt");
+        lua_pushinteger(L, st->rttvar);
+        lua_setfield(L, -2, "rttvar");
+        lua_pushinteger(L, st->retrans);
+        lua_setfield(L, -2, "retrans");
+    }
+}
+
+// (id), return the stat table or nil
+static int
+lstat(lua_State *L) {
+    int id = luaL_checkinteger(L, 1);
+    struct socket_stat st;
+    if (shaco_socket_stat(id, &st)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    pushstat(L, &st);
+    return 1;
+}
+
+// ([n], [by]), the top n stats by "sbuffer", "rate" or "idle"
+static int
+ltop(lua_State *L) {
+    static const char *opts[] = {"sbuffer", "rate", "idle", NULL};
+    int n = luaL_optinteger(L, 1, 10);
+    int by = luaL_checkoption(L, 2, "sbuffer", opts);
+    if (n < 0)
+        n = 0;
+    if (n > 1000)
+        n = 1000;
+    struct socket_stat *st = malloc(sizeof(*st) * (n > 0 ? n : 1));
+    int i, count = shaco_socket_top(by, st, n);
+    lua_createtable(L, count, 0);
+    for (i=0; i<count; ++i) {
+        pushstat(L, &st[i]);
+        lua_rawseti(L, -2, i+1);
+    }
+    free(st);
+    return 1;
+}
+
 // extra
 static int
 lunpack(lua_State *L) {
@@ -283,9 +526,18 @@ lunpack(lua_State *L) {
         return 4;
     case SOCKET_TYPE_CONNERR:
     case SOCKET_TYPE_SOCKERR:
+    case SOCKET_TYPE_BLOCKED:
+    case SOCKET_TYPE_WRITABLE:
         lua_pushinteger(L, type);
         lua_pushinteger(L, id);
         return 2;
+    case SOCKET_TYPE_UDP:
+        lua_pushinteger(L, type);
+        lua_pushinteger(L, id);
+        lua_pushlstring(L, msg->data, msg->size);
+        shaco_rbuf_free(msg->data);
+        lua_pushlstring(L, (const char *)msg->udpaddr, socket_udpaddrsz(msg->udpaddr));
+        return 4;
     default:
         return 2;
     }
@@ -298,6 +550,7 @@ luaopen_socket_c(lua_State *L) {
         {"bind", lbind },
         {"listen", llisten},
         {"connect", lconnect},
+        {"udp", ludp},
         {NULL, NULL},
 	}; 
     luaL_Reg l2[] = {
@@ -306,11 +559,21 @@ luaopen_socket_c(lua_State *L) {
         {"close", lclose},
         {"send", lsend},
         {"sendfd", lsendfd},
+        {"udpconnect", ludpconnect},
+        {"sendto", lsendto},
+        {"udpaddress", ludpaddress},
         {"readon", lreadon},
         {"readoff", lreadoff},
+        {"watermark", lwatermark},
+        {"readlimit", lreadlimit},
+        {"zerocopy", lzerocopy},
+        {"consumed", lconsumed},
         {"getfd", lgetfd},
         {"pair", lpair},
         {"drop", ldrop},
+        {"rbufstat", lrbufstat},
+        {"stat", lstat},
+        {"top", ltop},
         {"unpack", lunpack},
         {NULL, NULL},
     };
@@ -321,5 +584,11 @@ luaopen_socket_c(lua_State *L) {
 		return luaL_error(L, "init shaco context first");
 	luaL_setfuncs(L,l,1);
     luaL_setfuncs(L,l2,0);
+#ifdef SO_REUSEPORT
+    lua_pushboolean(L, 1);
+#else
+    lua_pushboolean(L, 0);
+#endif
+    lua_setfield(L, -2, "reuseport");
 	return 1;
 }
@@ -28,8 +28,8 @@ lclear(struct lua_State *L) {
     struct socket_buffer *sb = lua_touserdata(L, 1);
     while (sb->head) {
         struct buffer_node *next = sb->head->next;
-        free(sb->head->p);
-        free(sb->head);
+        shaco_rbuf_free(sb->head->p);
+        shaco_rbuf_free(sb->head);
         sb->head = next;
     }
     return 0;
@@ -57,7 +57,7 @@ lpush(struct lua_State *L) {
         lua_pushnil(L);
         return 1;
     }
-    struct buffer_node *node = malloc(sizeof(*node));
+    struct buffer_node *node = shaco_rbuf_alloc(sizeof(*node));
     node->p = p;
     node->sz = sz;
     node->next = NULL;
@@ -102,8 +102,8 @@ freebuffer(struct socket_buffer *sb,
                 sb->head = sb->head->next;
                 sb->size -= node->sz;
                 sb->offset = 0;
-                free(node->p);
-                free(node);
+                shaco_rbuf_free(node->p);
+                shaco_rbuf_free(node);
             } else {
                 sb->size -= end;
                 sb->offset = end;
@@ -113,8 +113,8 @@ freebuffer(struct socket_buffer *sb,
             tmp = sb->head;
             sb->head = sb->head->next;
             sb->size -= tmp->sz;
-            free(tmp->p);
-            free(tmp);
+            shaco_rbuf_free(tmp->p);
+            shaco_rbuf_free(tmp);
         }
     }
 }
@@ -238,9 +238,7 @@ lfindsep(struct lua_State *L) {
 }
 
 static int
-lpop(struct lua_State *L) {
-    luaL_checktype(L, 1, LUA_TUSERDATA);
-    struct socket_buffer *sb = lua_touserdata(L, 1); 
+popdata(struct lua_State *L, struct socket_buffer *sb) {
     int nargs = lua_gettop(L);
     if (nargs == 1) {
         return readall(L, sb);
@@ -263,6 +261,16 @@ lpop(struct lua_State *L) {
     }
 }
 
+// return the data or nil, and the size unconsumed
+static int
+lpop(struct lua_State *L) {
+    luaL_checktype(L, 1, LUA_TUSERDATA);
+    struct socket_buffer *sb = lua_touserdata(L, 1); 
+    popdata(L, sb);
+    lua_pushinteger(L, sb->size);
+    return 2;
+}
+
 static int
 ldetach(struct lua_State *L) {
     luaL_checktype(L, 1, LUA_TUSERDATA);
@@ -126,7 +126,8 @@ _handle_package(struct shaco_context *ctx, struct harbor *self, struct slave *s)
         }
         struct package_header header;
         void *p = _readheader(package.p, &header);
-        shaco_handle_send(header.dest, header.source, 
+        // only slot on the wire, send to the one in it now
+        shaco_handle_send(shaco_handle_slot(header.dest), header.source, 
                 header.session, header.type, p, package.sz-HEADSZ);
         shaco_free(package.p);
     } 
@@ -1,5 +1,6 @@
 #include "socket_buffer.h"
 #include "shaco_malloc.h"
+#include "shaco_rbuf.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -23,14 +24,14 @@ sb_fini(struct socket_buffer *sb) {
     while (sb->head) {
         tmp = sb->head;
         sb->head = sb->head->next;
-        shaco_free(tmp->p);
-        shaco_free(tmp);
+        shaco_rbuf_free(tmp->p);
+        shaco_rbuf_free(tmp);
     }
 }
 
 void
 sb_push(struct socket_buffer *sb, void *buf, int sz) {
-    struct buffer_node *node = shaco_malloc(sizeof(*node));
+    struct buffer_node *node = shaco_rbuf_alloc(sizeof(*node));
     node->p = buf;
     node->sz = sz;
     node->next = NULL;
@@ -76,8 +77,8 @@ freebuffer(struct socket_buffer *sb,
                 sb->head = sb->head->next;
                 sb->size -= node->sz;
                 sb->offset = 0;
-                shaco_free(node->p);
-                shaco_free(node);
+                shaco_rbuf_free(node->p);
+                shaco_rbuf_free(node);
             } else {
                 sb->size -= end;
                 sb->offset = end;
@@ -87,8 +88,8 @@ freebuffer(struct socket_buffer *sb,
             tmp = sb->head;
             sb->head = sb->head->next;
             sb->size -= tmp->sz;
-            shaco_free(tmp->p);
-            shaco_free(tmp);
+            shaco_rbuf_free(tmp->p);
+            shaco_rbuf_free(tmp);
         }
     }
 }
@@ -2,14 +2,26 @@
 #define __np_h__
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define NP_RABLE 1
 #define NP_WABLE 2
+// the read kind for the completion backend (NP_COMPLETION), with NP_RABLE
+#define NP_ACCEPT 4 // listen socket, np accept the connection
+#define NP_RECV   8 // stream socket, np recv the data
+// edge triggered, report the change only (NP_EDGE_TRIGGER backend)
+#define NP_EDGE  16
 
 struct np_event {
     void* ud;
     bool read;
     bool write;
+    // completion backend only, the read is done by np: size is the data
+    // size or the accepted fd, 0 for eof, or -errno, data is valid until
+    // the next np_poll
+    bool done;
+    int size;
+    void *data;
 };
 
 struct np_state;
@@ -19,8 +31,16 @@ static int np_add(struct np_state* np, int fd, int mask, void* ud);
 static int np_mod(struct np_state* np, int fd, int mask, void* ud); 
 static int np_del(struct np_state* np, int fd); 
 static int np_poll(struct np_state* np, struct np_event* e, int max, int timeout);
+// fd[0] for read and fd[1] for write, they may be the same one
+static int np_wakeup_open(int fd[2]);
+// a fd readable at the time, -1 if no support
+static int np_timer_open();
+// absolute usec of CLOCK_MONOTONIC, 0 to disarm
+static int np_timer_set(int fd, uint64_t usec);
     
-#ifdef __linux__
+#if defined(__linux__) && defined(NP_URING)
+#include "np_uring.h"
+#elif defined(__linux__)
 #include "np_epoll.h"
 #elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #include "np_kqueue.h"
@@ -28,5 +48,39 @@ static int np_poll(struct np_state* np, struct np_event* e, int max, int timeout
 #include "np_select.h"
 #endif
 
+#ifndef NP_WAKEUP_EVENTFD
+#include <unistd.h>
+#include <fcntl.h>
+
+static int
+np_wakeup_open(int fd[2]) {
+    if (pipe(fd))
+        return 1;
+    int i;
+    for (i=0; i<2; ++i) {
+        int flag = fcntl(fd[i], F_GETFL, 0);
+        if (flag == -1 ||
+            fcntl(fd[i], F_SETFL, flag | O_NONBLOCK) == -1 ||
+            fcntl(fd[i], F_SETFD, FD_CLOEXEC) == -1) {
+            close(fd[0]);
+            close(fd[1]);
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+#ifndef NP_TIMERFD
+static int
+np_timer_open() {
+    return -1;
+}
+
+static int
+np_timer_set(int fd, uint64_t usec) {
+    return -1;
+}
+#endif
 
 #endif
@@ -5,6 +5,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
+
+#define NP_EDGE_TRIGGER
 
 struct np_state {
     int epoll_fd;
@@ -44,6 +47,7 @@ _op(int epoll_fd, int fd, int op, int mask, void* ud) {
     e.events = 0;
     if (mask & NP_RABLE) e.events |= EPOLLIN;
     if (mask & NP_WABLE) e.events |= EPOLLOUT;
+    if (mask & NP_EDGE)  e.events |= EPOLLET;
     e.data.ptr = ud;
     return epoll_ctl(epoll_fd, op, fd, &e);
 }
@@ -80,4 +84,7 @@ np_poll(struct np_state* np, struct np_event* e, int max, int timeout) {
     }
     return n;
 }
+
+#include "np_linux.h"
+
 #endif
@@ -0,0 +1,40 @@
+#ifndef __np_linux_h__
+#define __np_linux_h__
+
+// linux wakeup and timer, shared by epoll and io_uring
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <string.h>
+
+#define NP_WAKEUP_EVENTFD
+
+// one eventfd instead of pipe, write 8 bytes counter to wakeup
+static int
+np_wakeup_open(int fd[2]) {
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd == -1)
+        return 1;
+    fd[0] = efd;
+    fd[1] = efd;
+    return 0;
+}
+
+#define NP_TIMERFD
+
+// timerfd break the poll in usec, epoll_wait timeout is msec only
+static int
+np_timer_open() {
+    return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+static int
+np_timer_set(int fd, uint64_t usec) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = usec / 1000000;
+    its.it_value.tv_nsec = (usec % 1000000) * 1000;
+    return timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+#endif
@@ -0,0 +1,570 @@
+#ifndef __np_uring_h__
+#define __np_uring_h__
+
+// io_uring, completion based: the listen socket use multishot accept,
+// the stream socket use multishot recv with the provided buffer ring,
+// the other fd (wakeup, timer, ipc, bind) use oneshot poll rearmed after
+// every event, like the level trigger.
+// the request is queued in the sq, and submit with the wait in one
+// io_uring_enter, or at once if the poll is waiting in other thread
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#define NP_COMPLETION
+
+#define URING_SQ_ENTRIES 1024
+#define URING_BUFSZ 8192
+
+// user_data: fd 32 bits | gen 16 bits | seq 8 bits | op 8 bits,
+// op is UOP with the read kind NP_ACCEPT or NP_RECV, 0 for ignore
+#define UOP_IGNORE 0 // cancel, nop
+#define UOP_READ   1 // poll in, accept or recv
+#define UOP_WRITE  2 // poll out
+#define UOP_MASK   3
+#define _udata(fd, gen, seq, op) \
+    ((uint64_t)(uint32_t)(fd) << 32 | (uint64_t)((gen) & 0xffff) << 16 | \
+     (uint64_t)((seq) & 0xff) << 8 | (op))
+
+struct np_fd {
+    void *ud;
+    int mask;
+    int armed; // UOP bit inflight
+    int canceling; // UOP bit canceled, arm again after its last completion
+    uint32_t gen; // bump when del, the completion of old one is dropped
+    uint8_t seq;  // bump when arm
+    uint64_t req[3]; // the armed user_data of UOP_READ and UOP_WRITE
+};
+
+// the ring is shared with the child after fork, the child must not touch it
+static unsigned URING_FORK = 0;
+
+static void
+_uring_atfork() {
+    URING_FORK++;
+}
+
+struct np_state {
+    int ring_fd;
+    unsigned fork;
+    pthread_mutex_t lock;
+    int waiting;
+    // sq
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    // cq
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_sz;
+    void *cq_ptr;
+    size_t cq_sz;
+    size_t sqes_sz;
+    // provided buffer, give back at the next poll
+    struct io_uring_buf_ring *br;
+    size_t br_sz;
+    char *bufs;
+    unsigned nbuf;
+    unsigned short br_tail;
+    unsigned short *used;
+    int nused;
+    // fd
+    struct np_fd *fds;
+    int nfd;
+};
+
+static inline int
+_uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t sz) {
+    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, sz);
+}
+
+static inline unsigned
+_uring_pending(struct np_state *np) {
+    return *np->sq_tail - __atomic_load_n(np->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+_uring_submit(struct np_state *np) {
+    unsigned n = _uring_pending(np);
+    while (n > 0) {
+        if (_uring_enter(np->ring_fd, n, 0, 0, NULL, 0) >= 0 || errno != EINTR)
+            break;
+    }
+}
+
+static struct io_uring_sqe *
+_uring_sqe(struct np_state *np) {
+    int i;
+    for (i=0; i<3; ++i) {
+        if (_uring_pending(np) < np->sq_entries) {
+            struct io_uring_sqe *sqe = &np->sqes[*np->sq_tail & np->sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+        _uring_submit(np);
+    }
+    return NULL;
+}
+
+static inline void
+_uring_push(struct np_state *np) {
+    __atomic_store_n(np->sq_tail, *np->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline void
+_buf_give(struct np_state *np, unsigned short bid) {
+    struct io_uring_buf *b = &np->br->bufs[np->br_tail & (np->nbuf-1)];
+    b->addr = (uint64_t)(uintptr_t)(np->bufs + (size_t)bid * URING_BUFSZ);
+    b->len = URING_BUFSZ;
+    b->bid = bid;
+    np->br_tail++;
+}
+
+static inline void
+_buf_commit(struct np_state *np) {
+    __atomic_store_n(&np->br->tail, np->br_tail, __ATOMIC_RELEASE);
+}
+
+static int
+_uring_mmap(struct np_state *np, struct io_uring_params *p) {
+    np->sq_sz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    np->cq_sz = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (np->cq_sz > np->sq_sz)
+            np->sq_sz = np->cq_sz;
+        np->cq_sz = 0;
+    }
+    np->sq_ptr = mmap(NULL, np->sq_sz, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, np->ring_fd, IORING_OFF_SQ_RING);
+    if (np->sq_ptr == MAP_FAILED) {
+        np->sq_ptr = NULL;
+        return 1;
+    }
+    if (np->cq_sz) {
+        np->cq_ptr = mmap(NULL, np->cq_sz, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, np->ring_fd, IORING_OFF_CQ_RING);
+        if (np->cq_ptr == MAP_FAILED) {
+            np->cq_ptr = NULL;
+            return 1;
+        }
+    } else {
+        np->cq_ptr = np->sq_ptr;
+    }
+    np->sqes_sz = p->sq_entries * sizeof(struct io_uring_sqe);
+    np->sqes = mmap(NULL, np->sqes_sz, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, np->ring_fd, IORING_OFF_SQES);
+    if (np->sqes == MAP_FAILED) {
+        np->sqes = NULL;
+        return 1;
+    }
+    char *sq = np->sq_ptr;
+    char *cq = np->cq_ptr;
+    np->sq_head = (unsigned*)(sq + p->sq_off.head);
+    np->sq_tail = (unsigned*)(sq + p->sq_off.tail);
+    np->sq_mask = *(unsigned*)(sq + p->sq_off.ring_mask);
+    np->sq_entries = *(unsigned*)(sq + p->sq_off.ring_entries);
+    unsigned *array = (unsigned*)(sq + p->sq_off.array);
+    unsigned i;
+    for (i=0; i<np->sq_entries; ++i)
+        array[i] = i;
+    np->cq_head = (unsigned*)(cq + p->cq_off.head);
+    np->cq_tail = (unsigned*)(cq + p->cq_off.tail);
+    np->cq_mask = *(unsigned*)(cq + p->cq_off.ring_mask);
+    np->cqes = (struct io_uring_cqe*)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+static int
+_uring_buffer(struct np_state *np, int max) {
+    unsigned n = 64;
+    while (n < max && n < 4096)
+        n <<= 1;
+    np->nbuf = n;
+    np->br_sz = sizeof(struct io_uring_buf) * n;
+    np->br = mmap(NULL, np->br_sz, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (np->br == MAP_FAILED) {
+        np->br = NULL;
+        return 1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)np->br;
+    reg.ring_entries = n;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, np->ring_fd,
+                IORING_REGISTER_PBUF_RING, &reg, 1))
+        return 1;
+    np->bufs = malloc((size_t)n * URING_BUFSZ);
+    np->used = malloc(sizeof(np->used[0]) * n);
+    np->nused = 0;
+    np->br_tail = 0;
+    unsigned i;
+    for (i=0; i<n; ++i)
+        _buf_give(np, i);
+    _buf_commit(np);
+    return 0;
+}
+
+static void
+np_fini(struct np_state* np) {
+    if (np->sqes)
+        munmap(np->sqes, np->sqes_sz);
+    if (np->cq_ptr && np->cq_ptr != np->sq_ptr)
+        munmap(np->cq_ptr, np->cq_sz);
+    if (np->sq_ptr)
+        munmap(np->sq_ptr, np->sq_sz);
+    if (np->br)
+        munmap(np->br, np->br_sz);
+    if (np->ring_fd != -1)
+        close(np->ring_fd);
+    free(np->bufs);
+    free(np->used);
+    free(np->fds);
+    pthread_mutex_destroy(&np->lock);
+    memset(np, 0, sizeof(*np));
+    np->ring_fd = -1;
+}
+
+static int
+np_init(struct np_state* np, int max) {
+    static int atfork = 0;
+    if (!atfork) {
+        atfork = 1;
+        pthread_atfork(NULL, NULL, _uring_atfork);
+    }
+    memset(np, 0, sizeof(*np));
+    np->fork = URING_FORK;
+    pthread_mutex_init(&np->lock, NULL);
+    struct io_uring_params p;
+    unsigned cq = URING_SQ_ENTRIES * 4;
+    while (cq < max * 2 && cq < 65536)
+        cq <<= 1;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+        IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = cq;
+    np->ring_fd = syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &p);
+    if (np->ring_fd == -1) {
+        // old kernel
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = cq;
+        np->ring_fd = syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &p);
+    }
+    if (np->ring_fd == -1 ||
+        !(p.features & IORING_FEAT_EXT_ARG) ||
+        fcntl(np->ring_fd, F_SETFD, FD_CLOEXEC) ||
+        _uring_mmap(np, &p) ||
+        _uring_buffer(np, max)) {
+        np_fini(np);
+        return 1;
+    }
+    return 0;
+}
+
+static struct np_fd *
+_uring_fd(struct np_state *np, int fd) {
+    if (fd < 0)
+        return NULL;
+    if (fd >= np->nfd) {
+        int n = np->nfd ? np->nfd : 64;
+        while (n <= fd)
+            n *= 2;
+        np->fds = realloc(np->fds, sizeof(np->fds[0]) * n);
+        memset(np->fds + np->nfd, 0, sizeof(np->fds[0]) * (n - np->nfd));
+        np->nfd = n;
+    }
+    return &np->fds[fd];
+}
+
+static int
+_uring_arm(struct np_state *np, int fd, int op) {
+    struct np_fd *f = &np->fds[fd];
+    struct io_uring_sqe *sqe = _uring_sqe(np);
+    if (sqe == NULL)
+        return 1;
+    int kind = op == UOP_READ ? (f->mask & (NP_ACCEPT|NP_RECV)) : 0;
+    sqe->fd = fd;
+    sqe->user_data = _udata(fd, f->gen, ++f->seq, op|kind);
+    if (op == UOP_WRITE) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLOUT;
+    } else if (kind & NP_ACCEPT) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    } else if (kind & NP_RECV) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+    } else {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+    }
+    f->req[op] = sqe->user_data;
+    f->armed |= op;
+    _uring_push(np);
+    return 0;
+}
+
+static void
+_uring_cancel(struct np_state *np, int fd, int op) {
+    struct np_fd *f = &np->fds[fd];
+    uint64_t target = f->req[op];
+    f->armed &= ~op;
+    if (!np->waiting) {
+        // not submit yet, nop it, the sq is touched by us only now
+        unsigned i;
+        unsigned head = __atomic_load_n(np->sq_head, __ATOMIC_ACQUIRE);
+        for (i=head; i != *np->sq_tail; ++i) {
+            struct io_uring_sqe *sqe = &np->sqes[i & np->sq_mask];
+            if (sqe->user_data == target) {
+                memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = UOP_IGNORE;
+                f->req[op] = 0;
+                return;
+            }
+        }
+    }
+    // keep the req to wait the last completion, the multishot recv armed
+    // again before that may read the stream out of order
+    f->canceling |= op;
+    struct io_uring_sqe *sqe = _uring_sqe(np);
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = UOP_IGNORE;
+        _uring_push(np);
+    }
+}
+
+static inline int
+_readkind(int mask) {
+    return (mask & NP_RABLE) ? (mask & (NP_RABLE|NP_ACCEPT|NP_RECV)) : 0;
+}
+
+static int
+_uring_set(struct np_state *np, int fd, int mask, void *ud) {
+    struct np_fd *f = _uring_fd(np, fd);
+    if (f == NULL)
+        return 1;
+    int old = f->mask;
+    int err = 0;
+    f->ud = ud;
+    f->mask = mask;
+    if (_readkind(old) != _readkind(mask)) {
+        if (f->armed & UOP_READ)
+            _uring_cancel(np, fd, UOP_READ);
+        if ((mask & NP_RABLE) && !(f->canceling & UOP_READ))
+            err |= _uring_arm(np, fd, UOP_READ);
+    }
+    if ((old & NP_WABLE) != (mask & NP_WABLE)) {
+        if (f->armed & UOP_WRITE)
+            _uring_cancel(np, fd, UOP_WRITE);
+        if ((mask & NP_WABLE) && !(f->canceling & UOP_WRITE))
+            err |= _uring_arm(np, fd, UOP_WRITE);
+    }
+    if (np->waiting)
+        _uring_submit(np);
+    return err;
+}
+
+static int
+np_add(struct np_state* np, int fd, int mask, void* ud) {
+    if (np->fork != URING_FORK)
+        return 1;
+    pthread_mutex_lock(&np->lock);
+    struct np_fd *f = _uring_fd(np, fd);
+    if (f) {
+        f->mask = 0;
+        f->armed = 0;
+    }
+    int err = _uring_set(np, fd, mask, ud);
+    pthread_mutex_unlock(&np->lock);
+    return err;
+}
+
+static int
+np_mod(struct np_state* np, int fd, int mask, void* ud) {
+    if (np->fork != URING_FORK)
+        return 1;
+    pthread_mutex_lock(&np->lock);
+    int err = _uring_set(np, fd, mask, ud);
+    pthread_mutex_unlock(&np->lock);
+    return err;
+}
+
+// must be called before close fd, the inflight request hold the file
+static int
+np_del(struct np_state* np, int fd) {
+    if (np->fork != URING_FORK)
+        return 0;
+    pthread_mutex_lock(&np->lock);
+    int err = 1;
+    if (fd >= 0 && fd < np->nfd) {
+        struct np_fd *f = &np->fds[fd];
+        if (f->armed & UOP_READ)
+            _uring_cancel(np, fd, UOP_READ);
+        if (f->armed & UOP_WRITE)
+            _uring_cancel(np, fd, UOP_WRITE);
+        f->ud = NULL;
+        f->mask = 0;
+        f->canceling = 0;
+        f->gen++;
+        if (np->waiting)
+            _uring_submit(np);
+        err = 0;
+    }
+    pthread_mutex_unlock(&np->lock);
+    return err;
+}
+
+// one cqe to event, return 1 if the event is set
+static int
+_uring_event(struct np_state *np, struct io_uring_cqe *cqe, struct np_event *e) {
+    uint64_t udata = cqe->user_data;
+    int op = udata & UOP_MASK;
+    int kind = udata & (NP_ACCEPT|NP_RECV);
+    int fd = (int)(udata >> 32);
+    int res = cqe->res;
+    char *data = NULL;
+    if (op == UOP_IGNORE)
+        return 0;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        np->used[np->nused++] = bid;
+        data = np->bufs + (size_t)bid * URING_BUFSZ;
+    }
+    struct np_fd *f = fd < np->nfd ? &np->fds[fd] : NULL;
+    if (f == NULL || (f->gen & 0xffff) != ((udata >> 16) & 0xffff)) {
+        // the fd is deleted, the accepted one has no owner
+        if ((kind & NP_ACCEPT) && res >= 0)
+            close(res);
+        return 0;
+    }
+    if (f->req[op] == udata && !(cqe->flags & IORING_CQE_F_MORE)) {
+        // the request end, rearm if still want it
+        int rearm;
+        f->armed &= ~op;
+        f->req[op] = 0;
+        f->canceling &= ~op;
+        if (kind & NP_RECV)
+            rearm = res > 0 || res == -ENOBUFS || res == -ECANCELED;
+        else if (kind & NP_ACCEPT)
+            rearm = res != -EBADF && res != -EINVAL && res != -ENOTSOCK;
+        else
+            rearm = 1; // oneshot poll
+        if (rearm && (f->mask & (op == UOP_WRITE ? NP_WABLE : NP_RABLE)))
+            _uring_arm(np, fd, op);
+    }
+    if (res == -ECANCELED || res == -ENOBUFS)
+        return 0;
+    e->ud = f->ud;
+    e->read = false;
+    e->write = false;
+    e->done = false;
+    e->size = 0;
+    e->data = NULL;
+    if (op == UOP_WRITE) {
+        e->write = true;
+    } else if (kind & NP_RECV) {
+        e->read = true;
+        e->done = true;
+        e->size = res;
+        e->data = data;
+    } else if (kind & NP_ACCEPT) {
+        if (res < 0)
+            return 0;
+        e->read = true;
+        e->done = true;
+        e->size = res;
+    } else {
+        if (res < 0)
+            return 0;
+        e->read = (res & (POLLIN|POLLHUP|POLLERR)) != 0;
+    }
+    return 1;
+}
+
+static int
+_uring_harvest(struct np_state *np, struct np_event *e, int max) {
+    int n = 0;
+    unsigned head = *np->cq_head;
+    unsigned tail = __atomic_load_n(np->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && n < max) {
+        struct io_uring_cqe *cqe = &np->cqes[head & np->cq_mask];
+        if (_uring_event(np, cqe, &e[n]))
+            n++;
+        head++;
+    }
+    __atomic_store_n(np->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+static int
+np_poll(struct np_state* np, struct np_event* e, int max, int timeout) {
+    if (np->fork != URING_FORK)
+        return 0;
+    pthread_mutex_lock(&np->lock);
+    // the data of last events is consumed
+    int i;
+    for (i=0; i<np->nused; ++i)
+        _buf_give(np, np->used[i]);
+    if (np->nused > 0) {
+        np->nused = 0;
+        _buf_commit(np);
+    }
+    int n = _uring_harvest(np, e, max);
+    if (n > 0 || timeout == 0) {
+        unsigned submit = _uring_pending(np);
+        if (n == 0 || submit > 0) {
+            // flush the overflow cq too
+            _uring_enter(np->ring_fd, submit, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (n == 0)
+                n = _uring_harvest(np, e, max);
+        }
+        pthread_mutex_unlock(&np->lock);
+        return n;
+    }
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout > 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    unsigned submit = _uring_pending(np);
+    np->waiting = 1;
+    pthread_mutex_unlock(&np->lock);
+    _uring_enter(np->ring_fd, submit, 1,
+            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    pthread_mutex_lock(&np->lock);
+    np->waiting = 0;
+    n = _uring_harvest(np, e, max);
+    pthread_mutex_unlock(&np->lock);
+    return n;
+}
+
+#include "np_linux.h"
+
+#endif
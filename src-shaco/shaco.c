@@ -7,6 +7,8 @@
 #include "shaco_context.h"
 #include "shaco_socket.h"
 #include "shaco_msg_dispatcher.h"
+#include "shaco_multicast.h"
+#include "shaco_rbuf.h"
 #include <stdbool.h>
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -19,7 +21,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 
-static bool RUN = false;
+static volatile bool RUN = false;
 static char STOP_INFO[32];
 static bool REOPENING = false;
 
@@ -179,8 +181,11 @@ shaco_init() {
     shaco_handle_init();
     sig_handler_init();
     rlimit_check();
+    shaco_rbuf_init(shaco_optint("rbufpool", 1024*1024));
     shaco_socket_init(shaco_optint("maxsocket", 0));
-    shaco_msg_dispatcher_init();
+    shaco_msg_dispatcher_init(shaco_optint("thread", 0), 
+            shaco_optint("mqquota", 64));
+    shaco_multicast_init();
 
     RUN = true; 
     STOP_INFO[0] = '\0';
@@ -197,10 +202,12 @@ shaco_fini() {
     if (pidfile) {
         unlink(pidfile);
     }
-    shaco_msg_dispatcher_fini();
     shaco_handle_fini();
+    shaco_msg_dispatcher_fini();
+    shaco_multicast_fini();
     shaco_module_fini();
     shaco_socket_fini();
+    shaco_rbuf_fini();
     shaco_log_close();
     shaco_timer_fini();
     shaco_env_fini();
@@ -208,20 +215,29 @@ shaco_fini() {
 
 void
 shaco_start() {
-    shaco_info(NULL, "Shaco start");
+    int thread = shaco_msg_threaded();
+    if (thread > 0) {
+        shaco_info(NULL, "Shaco start with %d worker thread", thread);
+        shaco_msg_dispatcher_start();
+    } else {
+        shaco_info(NULL, "Shaco start");
+    }
     int timeout;
     while (RUN) {
         timeout = shaco_timer_max_timeout();
-        if (!shaco_msg_empty()) 
+        if (thread == 0 && !shaco_msg_empty()) 
             timeout = 0;
         shaco_socket_poll(timeout);
         shaco_timer_trigger();
-        shaco_msg_dispatch();
+        if (thread == 0)
+            shaco_msg_dispatch();
+        shaco_socket_flush();
         if (REOPENING) {
             reopenlog();
             REOPENING = false;
         }
     }
+    shaco_msg_dispatcher_stop();
     shaco_info(NULL, "Shaco stop (%s)", STOP_INFO);
 }
 
@@ -230,4 +246,25 @@ shaco_stop(const char *info) {
     RUN = false;
     strncpy(STOP_INFO, info, sizeof(STOP_INFO));
     STOP_INFO[sizeof(STOP_INFO)-1] = '\0';
+    shaco_wakeup();
+}
+
+// wakeup the main loop, it only wait in poll with worker thread 
+void
+shaco_wakeup() {
+    if (shaco_msg_threaded()) {
+        shaco_socket_wakeup();
+    }
+}
+
+// for thread out of the loop (eg. compress, dns, disk io helper),
+// the msg must be alloc by shaco_malloc and owned by shaco after post
+int
+shaco_post(int dest, int source, int session, int type, const void *msg, int sz) {
+    int ret = shaco_msg_post(dest, source, session, type, msg, sz);
+    if (!shaco_msg_threaded()) {
+        // main loop may wait in poll
+        shaco_socket_wakeup();
+    }
+    return ret;
 }
@@ -19,7 +19,9 @@ struct shaco_context;
 #define SHACO_TSOCKET 7
 #define SHACO_TTIME 8
 #define SHACO_TREMOTE 9
+#define SHACO_TMULTICAST 11
 #define SHACO_DONT_COPY 0x80000000
+#define SHACO_SHARED    0x40000000
 
 typedef int (*shaco_cb)(
         struct shaco_context *ctx, 
@@ -34,10 +36,18 @@ void shaco_init();
 void shaco_fini();
 void shaco_start();
 void shaco_stop(const char* info);
+void shaco_wakeup();
 
 uint32_t shaco_launch(struct shaco_context *ctx, const char *name);
 void shaco_callback(struct shaco_context *context, shaco_cb cb, void *ud);
 int  shaco_send(struct shaco_context *ctx, int dest, int session, int type, const void *msg, int sz);
+int  shaco_post(int dest, int source, int session, int type, const void *msg, int sz);
+
+// refcounted immutable payload, send it with SHACO_SHARED to many dest,
+// every dest hold one ref until dispatched, the creator release its own
+void *shaco_shared_create(const void *msg, int sz);
+void  shaco_shared_grab(const void *p);
+void  shaco_shared_release(const void *p);
 const char *shaco_command(struct shaco_context *ctx, const char *name, const char *param);
 
 void shaco_backtrace(struct shaco_context *ctx);
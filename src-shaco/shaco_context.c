@@ -3,6 +3,8 @@
 #include "shaco_module.h"
 #include "shaco_handle.h"
 #include "shaco_log.h"
+#include "shaco_msg_dispatcher.h"
+#include "shaco_multicast.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -11,12 +13,26 @@ struct shaco_context {
     struct shaco_module *module;
     const char *name;
     uint32_t handle;
+    int ref;
+    struct shaco_mq *mq;
     void *instance;
     shaco_cb cb;
     void *ud;
     char result[32];
 };
 
+static void
+_context_delete(struct shaco_context *ctx) {
+    shaco_module_instance_free(ctx->module, ctx->instance);
+    ctx->module = NULL;
+    ctx->instance = NULL;
+    shaco_mq_release(ctx->mq);
+    ctx->mq = NULL;
+    shaco_free((void*)ctx->name);
+    ctx->name = NULL;
+    shaco_free(ctx);
+}
+
 uint32_t
 shaco_context_create(const char *name, const char *args) {
     struct shaco_module *dl = shaco_module_query(name);
@@ -29,31 +45,61 @@ shaco_context_create(const char *name, const char *args) {
     ctx->name = shaco_strdup(name);
     ctx->cb = NULL;
     ctx->ud = NULL;
-    ctx->instance = shaco_module_instance_create(dl);
+    ctx->ref = 1; // for handle
     ctx->handle = shaco_handle_register(ctx);
+    if (ctx->handle == 0) {
+        shaco_error(NULL, "Context `%s %s` create fail: no free handle", name, args);
+        shaco_free((void*)ctx->name);
+        shaco_free(ctx);
+        return 0;
+    }
+    ctx->instance = shaco_module_instance_create(dl);
+    ctx->mq = shaco_mq_create(ctx->handle);
+    uint32_t handle = ctx->handle;
+    int result = 0;
     if (ctx->module->init) {
-        if (ctx->module->init(ctx, ctx->instance, args)) {
-            shaco_context_free(ctx);
-            return 0;
-        }
+        result = ctx->module->init(ctx, ctx->instance, args);
     }
-    return ctx->handle;
+    // message received in init can dispatch now
+    shaco_mq_schedule(ctx->mq);
+    if (result) {
+        shaco_context_free(ctx);
+        return 0;
+    }
+    return handle;
 }
 
+// unregister the handle, the context delete when the last reference release
 void 
 shaco_context_free(struct shaco_context *ctx) {
     if (ctx) {
         shaco_handle_unregister(ctx);
-        ctx->handle = 0;
-        shaco_module_instance_free(ctx->module, ctx->instance);
-        ctx->module = NULL;
-        ctx->instance = NULL;
-        shaco_free((void*)ctx->name);
-        ctx->name = NULL;
-        shaco_free(ctx);
+        shaco_context_release(ctx);
     }
 }
 
+void
+shaco_context_grab(struct shaco_context *ctx) {
+    __sync_add_and_fetch(&ctx->ref, 1);
+}
+
+void
+shaco_context_release(struct shaco_context *ctx) {
+    if (__sync_sub_and_fetch(&ctx->ref, 1) == 0) {
+        _context_delete(ctx);
+    }
+}
+
+struct shaco_mq *
+shaco_context_mq(struct shaco_context *ctx) {
+    return ctx->mq;
+}
+
+int
+shaco_context_mqlen(struct shaco_context *ctx) {
+    return shaco_mq_length(ctx->mq);
+}
+
 uint32_t 
 shaco_context_handle(struct shaco_context *ctx) {
     return ctx->handle;
@@ -190,17 +236,84 @@ cmd_setloglevel(struct shaco_context *ctx, const char *param) {
     return NULL;
 }
 
+// param is handle number or name
+static uint32_t
+_tohandle(const char *param) {
+    char *end;
+    uint32_t handle = strtoul(param, &end, 0);
+    if (param[0] == '\0' || *end != '\0')
+        handle = shaco_handle_query(param);
+    return handle;
+}
+
 static const char *
 cmd_kill(struct shaco_context *ctx, const char *param) {
     // todo
-    uint32_t handle = shaco_handle_query(param);
+    uint32_t handle = _tohandle(param);
     if (handle > 0) {
-        struct shaco_context *c = shaco_context_get(handle);
-        if (c != ctx) {
+        struct shaco_context *c = shaco_handle_grab(handle);
+        if (c && c != ctx) {
             shaco_info(ctx, "Kill [%02x] %s", handle, param);
             shaco_context_free(c);
             shaco_info(ctx, "Kill [%02x] %s", handle, param);
         }
+        if (c) {
+            shaco_context_release(c);
+        }
+    }
+    return NULL;
+}
+
+static const char *
+cmd_mqlen(struct shaco_context *ctx, const char *param) {
+    uint32_t handle;
+    if (param[0] == '\0') {
+        handle = ctx->handle;
+    } else {
+        handle = _tohandle(param);
+    }
+    struct shaco_context *c = shaco_handle_grab(handle);
+    if (c == NULL) {
+        return NULL;
+    }
+    sprintf(ctx->result, "%d", shaco_context_mqlen(c));
+    shaco_context_release(c);
+    return ctx->result;
+}
+
+static const char *
+cmd_mcreate(struct shaco_context *ctx, const char *param) {
+    sprintf(ctx->result, "%u", shaco_multicast_create());
+    return ctx->result;
+}
+
+static const char *
+cmd_mdelete(struct shaco_context *ctx, const char *param) {
+    if (shaco_multicast_delete(strtoul(param, NULL, 10))) {
+        return "no channel";
+    }
+    return NULL;
+}
+
+// param: channel [handle], default self
+static const char *
+cmd_msub(struct shaco_context *ctx, const char *param) {
+    char *p;
+    uint32_t id = strtoul(param, &p, 10);
+    uint32_t handle = strtoul(p, NULL, 0);
+    if (shaco_multicast_subscribe(id, handle ? handle : ctx->handle)) {
+        return "no channel";
+    }
+    return NULL;
+}
+
+static const char *
+cmd_munsub(struct shaco_context *ctx, const char *param) {
+    char *p;
+    uint32_t id = strtoul(param, &p, 10);
+    uint32_t handle = strtoul(p, NULL, 0);
+    if (shaco_multicast_unsubscribe(id, handle ? handle : ctx->handle)) {
+        return "no channel";
     }
     return NULL;
 }
@@ -223,6 +336,11 @@ struct command C[] = {
     { "GETLOGLEVEL", cmd_getloglevel },
     { "SETLOGLEVEL", cmd_setloglevel },
     { "KILL", cmd_kill },
+    { "MQLEN", cmd_mqlen },
+    { "MCREATE", cmd_mcreate },
+    { "MDELETE", cmd_mdelete },
+    { "MSUB", cmd_msub },
+    { "MUNSUB", cmd_munsub },
     { "ABORT", cmd_abort },
     { NULL, NULL },
 };
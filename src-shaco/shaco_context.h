@@ -4,11 +4,15 @@
 #include <stdint.h>
 
 struct shaco_context;
+struct shaco_mq;
 
 uint32_t shaco_context_create(const char *name, const char *args);
 void shaco_context_free(struct shaco_context *ctx);
 uint32_t shaco_context_handle(struct shaco_context *ctx);
 int  shaco_context_send(struct shaco_context *ctx, int source, int session, int type, const void *msg, int sz);
-struct shaco_context *shaco_context_get(uint32_t handle);
+void shaco_context_grab(struct shaco_context *ctx);
+void shaco_context_release(struct shaco_context *ctx);
+struct shaco_mq *shaco_context_mq(struct shaco_context *ctx);
+int  shaco_context_mqlen(struct shaco_context *ctx);
 
 #endif
@@ -1,8 +1,10 @@
 #include "shaco_malloc.h"
 #include "lua.h"
 #include "lauxlib.h" 
+#include <pthread.h>
 
 static lua_State *L;
+static pthread_mutex_t LOCK = PTHREAD_MUTEX_INITIALIZER;
 
 void 
 shaco_env_init() {
@@ -19,16 +21,20 @@ shaco_env_fini() {
 
 const char* 
 shaco_getenv(const char* key) {
+    pthread_mutex_lock(&LOCK);
     lua_getglobal(L, key);
     const char *s = lua_tostring(L, -1);
     lua_pop(L, 1);
+    pthread_mutex_unlock(&LOCK);
     return s;
 }
 
 void 
 shaco_setenv(const char* key, const char* value) {
+    pthread_mutex_lock(&LOCK);
     lua_pushstring(L, value);
     lua_setglobal(L, key);
+    pthread_mutex_unlock(&LOCK);
 }
 
 int 
@@ -3,96 +3,267 @@
 #include "shaco_context.h"
 #include "shaco_module.h"
 #include "shaco_log.h"
+#include "shaco_msg_dispatcher.h"
+#include <pthread.h>
 #include <string.h>
 
+#define NAME_HASH_INIT 16
+
+// interned name, chained in hash bucket
 struct namehandle {
-    char *name;
+    struct namehandle *next;
+    uint32_t hash;
     uint32_t handle;
+    char *name;
 };
 
 static struct {
+    pthread_rwlock_t lock;
     int context_cap;
     int context_count;
+    int slot_index;
     struct shaco_context **contexts;
-    int handle_cap;
-    int handle_count;
-    struct namehandle *handles;
+    uint16_t *gens;
+    int name_cap;
+    int name_count;
+    uint32_t name_version;
+    struct namehandle **names;
 } *H = NULL;
 
+static inline uint32_t
+_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; ++name) {
+        h ^= (uint8_t)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static inline int
+_slot(uint32_t handle) {
+    return (handle & HANDLE_SLOT_MASK) - 1;
+}
+
 uint32_t 
 shaco_handle_query(const char *name) {
+    uint32_t handle = 0;
+    uint32_t hash = _hash(name);
+    pthread_rwlock_rdlock(&H->lock);
+    struct namehandle *h = H->names[hash & (H->name_cap-1)];
+    for (; h; h = h->next) {
+        if (h->hash == hash && strcmp(name, h->name) == 0) {
+            handle = h->handle;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&H->lock);
+    return handle;
+}
+
+// change when any name bind or unbind, for the caller name cache
+uint32_t
+shaco_handle_version() {
+    return __atomic_load_n(&H->name_version, __ATOMIC_ACQUIRE);
+}
+
+static void
+_name_rehash(int cap) {
+    struct namehandle **names = shaco_malloc(sizeof(names[0]) * cap);
+    memset(names, 0, sizeof(names[0]) * cap);
     int i;
-    for (i=0; i<H->handle_count; ++i) {
-        if (strcmp(name, H->handles[i].name) == 0)
-            return H->handles[i].handle;
+    for (i=0; i<H->name_cap; ++i) {
+        struct namehandle *h = H->names[i];
+        while (h) {
+            struct namehandle *next = h->next;
+            struct namehandle **slot = &names[h->hash & (cap-1)];
+            h->next = *slot;
+            *slot = h;
+            h = next;
+        }
     }
-    return 0;
+    shaco_free(H->names);
+    H->names = names;
+    H->name_cap = cap;
 }
 
+// remove the name bind to the handle, call with write lock
+static int
+_name_unbind(uint32_t handle) {
+    int n = 0;
+    int i;
+    for (i=0; i<H->name_cap; ++i) {
+        struct namehandle **p = &H->names[i];
+        while (*p) {
+            struct namehandle *h = *p;
+            if (h->handle == handle) {
+                *p = h->next;
+                shaco_free(h->name);
+                shaco_free(h);
+                H->name_count--;
+                n++;
+            } else {
+                p = &h->next;
+            }
+        }
+    }
+    return n;
+}
+
+// return 0 if no free slot
 uint32_t 
 shaco_handle_register(struct shaco_context *ctx) {
-    if (H->context_count == H->context_cap) {
-        H->context_cap = H->context_cap*2;
-        H->contexts = shaco_realloc(H->contexts, sizeof(H->contexts[0])*H->context_cap);
+    uint32_t handle = 0;
+    pthread_rwlock_wrlock(&H->lock);
+    if (H->context_count == H->context_cap && H->context_cap < HANDLE_SLOT_MASK) {
+        int cap = H->context_cap*2;
+        if (cap > HANDLE_SLOT_MASK)
+            cap = HANDLE_SLOT_MASK;
+        H->contexts = shaco_realloc(H->contexts, sizeof(H->contexts[0])*cap);
+        H->gens = shaco_realloc(H->gens, sizeof(H->gens[0])*cap);
+        memset(H->contexts + H->context_cap, 0, sizeof(H->contexts[0])*(cap-H->context_cap));
+        memset(H->gens + H->context_cap, 0, sizeof(H->gens[0])*(cap-H->context_cap));
+        H->context_cap = cap;
+    }
+    // go on from the last one, so the slot just free is not reuse at once
+    int i;
+    for (i=0; i<H->context_cap; ++i) {
+        int slot = (H->slot_index+i) % H->context_cap;
+        if (H->contexts[slot] == NULL) {
+            H->contexts[slot] = ctx;
+            H->context_count++;
+            H->slot_index = slot+1;
+            handle = (slot+1) | ((uint32_t)H->gens[slot] << HANDLE_GEN_SHIFT);
+            break;
+        }
     }
-    H->contexts[H->context_count++] = ctx;
-    uint32_t handle = H->context_count;
+    pthread_rwlock_unlock(&H->lock);
     return handle;
 }
 
 void 
 shaco_handle_unregister(struct shaco_context *ctx) {
     uint32_t handle = shaco_context_handle(ctx);
-    if (handle > 0 && handle <= H->context_count) {
-        H->contexts[handle-1] = NULL;
+    int slot = _slot(handle);
+    pthread_rwlock_wrlock(&H->lock);
+    if (slot >= 0 && slot < H->context_cap && H->contexts[slot] == ctx) {
+        H->contexts[slot] = NULL;
+        H->context_count--;
+        // the old handle is stale now
+        H->gens[slot] = (H->gens[slot]+1) & HANDLE_GEN_MASK;
+        if (_name_unbind(handle) > 0) {
+            __atomic_add_fetch(&H->name_version, 1, __ATOMIC_RELEASE);
+        }
     }
+    pthread_rwlock_unlock(&H->lock);
 }
 
+// bind again replace the old handle
 void
 shaco_handle_bindname(uint32_t handle, const char *name) {
-    if (H->handle_count == H->handle_cap) {
-        H->handle_cap = H->handle_cap*2;
-        H->handles = shaco_realloc(H->handles, sizeof(H->handles[0]) * H->handle_cap);
+    uint32_t hash = _hash(name);
+    pthread_rwlock_wrlock(&H->lock);
+    struct namehandle *h = H->names[hash & (H->name_cap-1)];
+    for (; h; h = h->next) {
+        if (h->hash == hash && strcmp(name, h->name) == 0) {
+            h->handle = handle;
+            break;
+        }
+    }
+    if (h == NULL) {
+        if (H->name_count >= H->name_cap) {
+            _name_rehash(H->name_cap*2);
+        }
+        h = shaco_malloc(sizeof(*h));
+        h->hash = hash;
+        h->handle = handle;
+        h->name = shaco_strdup(name);
+        struct namehandle **slot = &H->names[hash & (H->name_cap-1)];
+        h->next = *slot;
+        *slot = h;
+        H->name_count++;
     }
-    struct namehandle *h = &H->handles[H->handle_count++];
-    h->name = shaco_strdup(name);
-    h->handle = handle;
+    __atomic_add_fetch(&H->name_version, 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&H->lock);
 }
 
+// the msg is not owned, it is copied to the mailbox in thread mode
 int
 shaco_handle_send(int dest, int source, int session, int type, const void *msg, int sz) {
-    if (dest > 0 && dest <= H->context_count) {
-        struct shaco_context *ctx = H->contexts[dest-1];
-        if (ctx) {
-            return shaco_context_send(ctx, source, session, type, msg, sz);
-        } else {
-            shaco_error(NULL,"Context no found: %0x->%0x session:%d type:%d sz:%d",
-                    source, dest, session, type, sz);
-        }
+    if (shaco_msg_threaded()) {
+        return shaco_msg_postcopy(dest, source, session, type, msg, sz);
+    }
+    struct shaco_context *ctx = shaco_handle_grab(dest);
+    if (ctx) {
+        int result = shaco_context_send(ctx, source, session, type, msg, sz);
+        shaco_context_release(ctx);
+        return result;
     } else {
-        shaco_error(NULL,"Invalid dest handle: %0x->%0x session:%d type:%d sz:%d",
+        shaco_error(NULL,"Context no found: %0x->%0x session:%d type:%d sz:%d",
                 source, dest, session, type, sz);
     }
     return 1;
 }
 
+// stale handle (generation not match) get NULL
 struct shaco_context *
-shaco_context_get(uint32_t handle) {
-    if (handle > 0 && handle <= H->context_count) {
-        return H->contexts[handle-1];
-    } else
-        return NULL;
+shaco_handle_grab(uint32_t handle) {
+    struct shaco_context *ctx = NULL;
+    int slot = _slot(handle);
+    pthread_rwlock_rdlock(&H->lock);
+    if (slot >= 0 && slot < H->context_cap) {
+        ctx = H->contexts[slot];
+        if (ctx && shaco_context_handle(ctx) == handle) {
+            shaco_context_grab(ctx);
+        } else {
+            ctx = NULL;
+        }
+    }
+    pthread_rwlock_unlock(&H->lock);
+    return ctx;
+}
+
+// the current handle in slot, for remote message only carry the slot
+uint32_t
+shaco_handle_slot(int slot) {
+    uint32_t handle = 0;
+    pthread_rwlock_rdlock(&H->lock);
+    if (slot > 0 && slot <= H->context_cap && H->contexts[slot-1]) {
+        handle = shaco_context_handle(H->contexts[slot-1]);
+    }
+    pthread_rwlock_unlock(&H->lock);
+    return handle;
+}
+
+// cb is called with the lock held, do not register or unregister in it
+void
+shaco_handle_foreach(void (*cb)(struct shaco_context *ctx, void *ud), void *ud) {
+    int i;
+    pthread_rwlock_rdlock(&H->lock);
+    for (i=0; i<H->context_cap; ++i) {
+        if (H->contexts[i]) {
+            cb(H->contexts[i], ud);
+        }
+    }
+    pthread_rwlock_unlock(&H->lock);
 }
 
 void
 shaco_handle_init() {
     H = shaco_malloc(sizeof(*H));
+    pthread_rwlock_init(&H->lock, NULL);
     H->context_cap = 1;
     H->context_count = 0;
+    H->slot_index = 0;
     H->contexts = shaco_malloc(sizeof(H->contexts[0])*H->context_cap);
-    H->handle_cap = 1;
-    H->handle_count = 0;
-    H->handles = shaco_malloc(sizeof(H->handles[0])*H->handle_cap);
+    H->gens = shaco_malloc(sizeof(H->gens[0])*H->context_cap);
+    memset(H->contexts, 0, sizeof(H->contexts[0])*H->context_cap);
+    memset(H->gens, 0, sizeof(H->gens[0])*H->context_cap);
+    H->name_cap = NAME_HASH_INIT;
+    H->name_count = 0;
+    H->name_version = 0;
+    H->names = shaco_malloc(sizeof(H->names[0])*H->name_cap);
+    memset(H->names, 0, sizeof(H->names[0])*H->name_cap);
 }
 
 void
@@ -101,20 +272,29 @@ shaco_handle_fini() {
         return;
     if (H->contexts) {
         int i;
-        for (i=0; i<H->context_count; ++i) {
+        for (i=0; i<H->context_cap; ++i) {
             shaco_context_free(H->contexts[i]);
         } 
         shaco_free(H->contexts); 
         H->contexts = NULL; 
+        shaco_free(H->gens);
+        H->gens = NULL;
     }
-    if (H->handles) {
+    if (H->names) {
         int i; 
-        for (i=0; i<H->handle_count; ++i) {
-            shaco_free(H->handles[i].name);
+        for (i=0; i<H->name_cap; ++i) {
+            struct namehandle *h = H->names[i];
+            while (h) {
+                struct namehandle *next = h->next;
+                shaco_free(h->name);
+                shaco_free(h);
+                h = next;
+            }
         }
-        shaco_free(H->handles);
-        H->handles = NULL;
+        shaco_free(H->names);
+        H->names = NULL;
     }
+    pthread_rwlock_destroy(&H->lock);
     shaco_free(H);
     H = NULL;
 }
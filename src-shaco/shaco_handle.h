@@ -5,13 +5,23 @@
 
 struct shaco_context;
 
+// handle: bit 0~7 local slot, bit 8~15 harbor slave id, bit 16~30 generation,
+// the generation change when the slot reuse, so stale handle is rejected
+#define HANDLE_SLOT_MASK 0xff
+#define HANDLE_GEN_SHIFT 16
+#define HANDLE_GEN_MASK  0x7fff
+
 void shaco_handle_init();
 void shaco_handle_fini();
 
 uint32_t shaco_handle_register(struct shaco_context *ctx);
 void shaco_handle_unregister(struct shaco_context *ctx);
 uint32_t shaco_handle_query(const char *name);
+uint32_t shaco_handle_version();
+uint32_t shaco_handle_slot(int slot);
 void shaco_handle_bindname(uint32_t handle, const char *name);
 int  shaco_handle_send(int dest, int source, int session, int type, const void *msg, int sz);
+struct shaco_context *shaco_handle_grab(uint32_t handle);
+void shaco_handle_foreach(void (*cb)(struct shaco_context *ctx, void *ud), void *ud);
 
 #endif
@@ -2,7 +2,9 @@
 #include "shaco_harbor.h"
 #include "shaco_context.h"
 #include "shaco_log.h"
+#include "shaco_msg_dispatcher.h"
 #include <assert.h>
+#include <string.h>
 
 static struct shaco_context *H;
 
@@ -14,12 +16,23 @@ shaco_harbor_start(struct shaco_context *ctx) {
 
 int
 shaco_harbor_isremote(int handle) {
-    return (handle>>8) != 0;
+    return ((handle>>8) & 0xff) != 0;
 }
 
 int
 shaco_harbor_send(int dest, int source, int session, int type, const void *msg, int sz) {
     if (H) {
+        if (shaco_msg_threaded()) {
+            // harbor context may be running on other thread, post it
+            struct shaco_remote_message *rmsg = shaco_malloc(sizeof(*rmsg)+sz);
+            rmsg->dest = dest;
+            rmsg->type = type;
+            rmsg->msg = rmsg+1;
+            rmsg->sz = sz;
+            memcpy(rmsg+1, msg, sz);
+            return shaco_msg_post(shaco_context_handle(H), source, session, 
+                    SHACO_TREMOTE, rmsg, sizeof(*rmsg));
+        }
         struct shaco_remote_message rmsg;
         rmsg.dest = dest;
         rmsg.type = type;
@@ -67,12 +67,14 @@ _prefix(struct shaco_context *ctx, int level) {
     uint64_t now = shaco_timer_now();
     time_t sec = now / 1000;
     uint32_t msec = now % 1000;
-    strftime(tmp, sizeof(tmp), "%y%m%d-%H:%M:%S.", localtime(&sec));
+    struct tm tm;
+    strftime(tmp, sizeof(tmp), "%y%m%d-%H:%M:%S.", localtime_r(&sec, &tm));
     fprintf(F, "%d %s%03u %c [%02x] ", (int)getpid(), tmp, msec, STR_LEVELS[level], ctx ? shaco_context_handle(ctx):0 );
 }
 
 static inline void
 _log(struct shaco_context *ctx, int level, const char *log) {
+    flockfile(F);
     _prefix(ctx, level);
     int tag = _color_begin(level);
     if (tag)
@@ -80,10 +82,12 @@ _log(struct shaco_context *ctx, int level, const char *log) {
     else
         fprintf(F, "%s\n", log);
     fflush(F);
+    funlockfile(F);
 }
 
 static inline void
 _logv(struct shaco_context *ctx, int level, const char *fmt, va_list ap) {
+    flockfile(F);
     _prefix(ctx, level);
     int tag = _color_begin(level);
     vfprintf(F, fmt, ap);
@@ -92,6 +96,7 @@ _logv(struct shaco_context *ctx, int level, const char *fmt, va_list ap) {
     else
         fprintf(F, "%s", "\n");
     fflush(F);
+    funlockfile(F);
 }
 
 void
@@ -28,6 +28,9 @@ malloc_usable_size(void *ptr) {
 
 static size_t _used_memory = 0;
 
+#define _used_add(n) __sync_add_and_fetch(&_used_memory, (n))
+#define _used_sub(n) __sync_sub_and_fetch(&_used_memory, (n))
+
 static inline void
 _oom(size_t size) {
     shaco_error(NULL, "Out of memory trying to malloc %zu bytes", size);
@@ -41,11 +44,11 @@ shaco_malloc(size_t size) {
         _oom(size);
     }
 #ifdef HAVE_MALLOC
-    _used_memory += malloc_usable_size(ptr);
+    _used_add(malloc_usable_size(ptr));
     return ptr;
 #else
     *(size_t*)ptr = size;
-    _used_memory += size+PREFIX_SIZE;
+    _used_add(size+PREFIX_SIZE);
     return (char*)ptr+PREFIX_SIZE;
 #endif
 }
@@ -58,17 +61,17 @@ shaco_realloc(void *ptr, size_t size) {
 #ifndef HAVE_MALLOC
     ptr = (char*)ptr-PREFIX_SIZE;
 #endif
-    _used_memory -= malloc_usable_size(ptr);
+    _used_sub(malloc_usable_size(ptr));
     void *newptr = realloc(ptr, size+PREFIX_SIZE);
     if (newptr == NULL) {
         _oom(size);
     }
 #ifdef HAVE_MALLOC
-    _used_memory += malloc_usable_size(newptr);
+    _used_add(malloc_usable_size(newptr));
     return newptr;
 #else
     *(size_t*)newptr = size;
-    _used_memory += size;
+    _used_add(size);
     return (char*)newptr+PREFIX_SIZE;
 #endif
 }
@@ -80,11 +83,11 @@ shaco_calloc(size_t nmemb, size_t size) {
         _oom(nmemb*size);
     }
 #ifdef HAVE_MALLOC
-    _used_memory += malloc_usable_size(ptr);
+    _used_add(malloc_usable_size(ptr));
     return ptr;
 #else
     *(size_t*)ptr = size;
-    _used_memory += size+PREFIX_SIZE;
+    _used_add(size+PREFIX_SIZE);
     return (char*)ptr+PREFIX_SIZE;
 #endif
 }
@@ -93,14 +96,19 @@ void
 shaco_free(void *ptr) {
     if (ptr == NULL) return;
 #ifdef HAVE_MALLOC
-    _used_memory -= malloc_usable_size(ptr);
+    _used_sub(malloc_usable_size(ptr));
 #else
     ptr = (char*)ptr-PREFIX_SIZE;
-    _used_memory -= malloc_usable_size(ptr)+PREFIX_SIZE;
+    _used_sub(malloc_usable_size(ptr)+PREFIX_SIZE);
 #endif
     free(ptr);
 }
 
+size_t
+shaco_malloc_size(void *ptr) {
+    return malloc_usable_size((char*)ptr-PREFIX_SIZE);
+}
+
 char *
 shaco_strdup(const char *s) {
     size_t l = strlen(s)+1;
@@ -7,6 +7,8 @@ void *shaco_malloc(size_t size);
 void *shaco_realloc(void *ptr, size_t size);
 void *shaco_calloc(size_t nmemb, size_t size);
 void  shaco_free(void *ptr);
+// the size of the memory, at least the size of alloc
+size_t shaco_malloc_size(void *ptr);
 char *shaco_strdup(const char *s);
 void *shaco_lalloc(void *ud, void *ptr, size_t osize, size_t nsize);
 
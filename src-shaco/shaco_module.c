@@ -6,6 +6,9 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
+
+static pthread_mutex_t LOCK = PTHREAD_MUTEX_INITIALIZER;
 
 static struct {
     const char *path;
@@ -91,13 +94,20 @@ shaco_module_free(struct shaco_module *dl) {
 
 struct shaco_module *
 shaco_module_query(const char *name) {
+    struct shaco_module *dl = NULL;
     int i;
+    pthread_mutex_lock(&LOCK);
     for (i=0; i<M->sz; ++i) {
-        struct shaco_module* dl = M->p[i];
-        if (!strcmp(dl->name, name))
-            return dl;
+        if (!strcmp(M->p[i]->name, name)) {
+            dl = M->p[i];
+            break;
+        }
     }
-    return shaco_module_create(name);
+    if (dl == NULL) {
+        dl = shaco_module_create(name);
+    }
+    pthread_mutex_unlock(&LOCK);
+    return dl;
 }
 
 void *
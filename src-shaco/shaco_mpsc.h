@@ -0,0 +1,79 @@
+#ifndef __shaco_mpsc_h__
+#define __shaco_mpsc_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// intrusive multi-producer single-consumer queue, push never block and
+// never fail, embed mpsc_node as the first member of the element.
+// the consumer can park the empty queue by tag the tail, then the first
+// push after return 1, so the pusher know to schedule the consumer again
+struct mpsc_node {
+    struct mpsc_node *next;
+};
+
+struct mpsc_queue {
+    struct mpsc_node *tail; // producer side
+    struct mpsc_node *head; // consumer side
+    struct mpsc_node stub;
+};
+
+#define MPSC_PARKED(p) ((struct mpsc_node *)((uintptr_t)(p) | 1))
+#define MPSC_UNTAG(p)  ((struct mpsc_node *)((uintptr_t)(p) & ~(uintptr_t)1))
+
+static inline void
+mpsc_init(struct mpsc_queue *q) {
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+// any thread, return 1 if the queue is parked before
+static inline int
+mpsc_push(struct mpsc_queue *q, struct mpsc_node *n) {
+    __atomic_store_n(&n->next, NULL, __ATOMIC_RELAXED);
+    struct mpsc_node *prev = __atomic_exchange_n(&q->tail, n, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&MPSC_UNTAG(prev)->next, n, __ATOMIC_RELEASE);
+    return prev != MPSC_UNTAG(prev);
+}
+
+// consumer only, return NULL if empty or some producer is in the middle of push
+static inline struct mpsc_node *
+mpsc_pop(struct mpsc_queue *q) {
+    struct mpsc_node *head = q->head;
+    struct mpsc_node *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (head == &q->stub) {
+        if (next == NULL)
+            return NULL;
+        q->head = next;
+        head = next;
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        q->head = next;
+        return head;
+    }
+    if (head != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    // the last one, put stub back so head can move on
+    mpsc_push(q, &q->stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        q->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+// consumer only, return 1 if the queue is empty and parked, the consumer
+// must not touch the queue after that, return 0 if something left
+static inline int
+mpsc_park(struct mpsc_queue *q) {
+    struct mpsc_node *stub = &q->stub;
+    if (q->head != stub)
+        return 0;
+    return __atomic_compare_exchange_n(&q->tail, &stub, MPSC_PARKED(stub),
+            0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+#endif
@@ -1,106 +1,376 @@
+#include "shaco_msg_dispatcher.h"
 #include "shaco_harbor.h"
+#include "shaco_mpsc.h"
 #include "shaco_context.h"
+#include "shaco_handle.h"
 #include "shaco_malloc.h"
 #include "shaco_log.h"
 #include "shaco.h"
+#include <pthread.h>
+#include <signal.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
 
-#define INIT_CAP 8
+#define OVERLOAD_THRESHOLD 1024
 
+// refcounted payload head, the data follow
+struct shared {
+    int ref;
+    int sz;
+};
+
+// mailbox node, copied payload is hold inline in data,
+// shared payload keep SHACO_SHARED in type
 struct message {
+    struct mpsc_node node;
     int source;
-    int dest;
     int session;
     int type;
-    const void *msg;
     int sz;
+    const void *msg;
+    char data[0];
+};
+
+// per context mailbox, any thread can push, the mailbox is in the global
+// queue or dispatching until it is parked empty, so one context run on one
+// thread only, the first push after park schedule it again
+struct shaco_mq {
+    uint32_t handle;
+    int length;
+    int overload;
+    int overload_threshold;
+    struct mpsc_node release; // the last node after context gone
+    struct mpsc_queue q;
+    struct shaco_mq *next;
 };
 
 static struct {
-    int cap;
-    int sz;
-    int head;
-    int tail;
-    struct message *q;
-} *Q = NULL;
-
-static inline void 
-shaco_msg_push(int dest, int source, int session, int type, const void *msg, int sz) {
-    struct message *m = &Q->q[Q->tail];
-    m->source = source;
-    m->dest = dest;
-    m->session = session;
-    m->type = type;
-    m->msg = msg;
-    m->sz = sz;
-    Q->tail ++;
-    if (Q->tail == Q->cap) {
-        Q->tail = 0;
-    }
-    if (Q->tail == Q->head) {
-        int cap = Q->cap;
-        Q->cap = Q->cap*2;
-        Q->q = shaco_realloc(Q->q, sizeof(Q->q[0]) * Q->cap);
-        int i;
-        for (i=0; i<Q->tail; ++i) {
-            Q->q[cap+i] = Q->q[i];
+    int nworker;
+    int quota;
+    int sleeping;
+    bool quit;
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int count;
+    struct shaco_mq *head;
+    struct shaco_mq *tail;
+} *G = NULL;
+
+static void
+_global_push(struct shaco_mq *mq) {
+    pthread_mutex_lock(&G->lock);
+    mq->next = NULL;
+    if (G->tail) {
+        G->tail->next = mq;
+        G->tail = mq;
+    } else {
+        G->head = G->tail = mq;
+    }
+    G->count++;
+    if (G->sleeping > 0)
+        pthread_cond_signal(&G->cond);
+    pthread_mutex_unlock(&G->lock);
+}
+
+static struct shaco_mq *
+_global_pop(bool wait) {
+    struct shaco_mq *mq;
+    pthread_mutex_lock(&G->lock);
+    while (wait && G->head == NULL && !G->quit) {
+        G->sleeping++;
+        pthread_cond_wait(&G->cond, &G->lock);
+        G->sleeping--;
+    }
+    if (G->quit) {
+        mq = NULL;
+    } else {
+        mq = G->head;
+        if (mq) {
+            G->head = mq->next;
+            if (G->head == NULL)
+                G->tail = NULL;
+            mq->next = NULL;
+            G->count--;
         }
-        Q->tail = cap+Q->tail;
     }
+    pthread_mutex_unlock(&G->lock);
+    return mq;
+}
+
+struct shaco_mq *
+shaco_mq_create(uint32_t handle) {
+    struct shaco_mq *mq = shaco_malloc(sizeof(*mq));
+    mq->handle = handle;
+    mq->length = 0;
+    mq->overload = 0;
+    mq->overload_threshold = OVERLOAD_THRESHOLD;
+    // not parked, hold until shaco_mq_schedule, the context is not init yet
+    mpsc_init(&mq->q);
+    mq->next = NULL;
+    return mq;
+}
+
+void *
+shaco_shared_create(const void *msg, int sz) {
+    struct shared *s = shaco_malloc(sizeof(*s) + (sz > 0 ? sz : 0));
+    s->ref = 1;
+    s->sz = sz;
+    if (sz > 0) {
+        memcpy(s+1, msg, sz);
+    }
+    return s+1;
 }
 
-static inline struct message *
-shaco_msg_pop() {
-    if (Q->head == Q->tail) {
-        return NULL;
+void
+shaco_shared_grab(const void *p) {
+    struct shared *s = (struct shared *)p - 1;
+    __sync_add_and_fetch(&s->ref, 1);
+}
+
+void
+shaco_shared_release(const void *p) {
+    struct shared *s = (struct shared *)p - 1;
+    if (__sync_sub_and_fetch(&s->ref, 1) == 0) {
+        shaco_free(s);
     }
-    struct message *m = &Q->q[Q->head];
-    Q->head ++;
-    if (Q->head == Q->cap) {
-        Q->head = 0;
+}
+
+static inline void
+_message_free(struct message *m) {
+    if (m->type & SHACO_SHARED) {
+        shaco_shared_release(m->msg);
+    } else if (m->msg != m->data) {
+        shaco_free((void*)m->msg);
+    }
+    shaco_free(m);
+}
+
+static void
+_mq_push(struct shaco_mq *mq, struct mpsc_node *node) {
+    int n = __atomic_add_fetch(&mq->length, 1, __ATOMIC_RELAXED);
+    if (n > __atomic_load_n(&mq->overload_threshold, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&mq->overload, n, __ATOMIC_RELAXED);
+        __atomic_store_n(&mq->overload_threshold, n*2, __ATOMIC_RELAXED);
+    }
+    if (mpsc_push(&mq->q, node)) {
+        _global_push(mq);
+    }
+}
+
+static struct mpsc_node *
+_mq_pop(struct shaco_mq *mq) {
+    struct mpsc_node *node = mpsc_pop(&mq->q);
+    if (node) {
+        __atomic_sub_fetch(&mq->length, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&mq->overload_threshold, OVERLOAD_THRESHOLD, __ATOMIC_RELAXED);
+    }
+    return node;
+}
+
+int
+shaco_mq_length(struct shaco_mq *mq) {
+    return __atomic_load_n(&mq->length, __ATOMIC_RELAXED);
+}
+
+static void
+_mq_free(struct shaco_mq *mq) {
+    struct mpsc_node *node;
+    while ((node = _mq_pop(mq))) {
+        if (node != &mq->release)
+            _message_free((struct message *)node);
+    }
+    shaco_free(mq);
+}
+
+void
+shaco_mq_schedule(struct shaco_mq *mq) {
+    _global_push(mq);
+}
+
+// context has gone, nobody can push after this
+void
+shaco_mq_release(struct shaco_mq *mq) {
+    _mq_push(mq, &mq->release);
+}
+
+static void
+_dispatch_mq(struct shaco_mq *mq) {
+    struct shaco_context *ctx = shaco_handle_grab(mq->handle);
+    int overload = __atomic_exchange_n(&mq->overload, 0, __ATOMIC_RELAXED);
+    if (overload) {
+        shaco_warn(NULL, "Context [%02x] may overload, message queue length = %d",
+                mq->handle, overload);
+    }
+    // at most quota messages one turn, then the context go to the tail
+    int n = shaco_mq_length(mq);
+    if (G->quota > 0 && n > G->quota)
+        n = G->quota;
+    struct mpsc_node *node;
+    while (n-- > 0 && (node = _mq_pop(mq))) {
+        if (node == &mq->release) {
+            if (ctx) {
+                shaco_context_release(ctx);
+            }
+            _mq_free(mq);
+            return;
+        }
+        struct message *m = (struct message *)node;
+        if (ctx) {
+            shaco_context_send(ctx, m->source, m->session, 
+                    m->type & ~SHACO_SHARED, m->msg, m->sz);
+        } else {
+            shaco_error(NULL,"Context no found: %0x->%0x session:%d type:%d sz:%d",
+                    m->source, mq->handle, m->session, m->type & ~SHACO_SHARED, m->sz);
+        }
+        _message_free(m);
+    }
+    if (ctx) {
+        shaco_context_release(ctx);
+    }
+    // do not touch mq after parked, the next push will schedule it
+    if (!mpsc_park(&mq->q)) {
+        _global_push(mq);
     }
-    return m;
 }
 
 void
 shaco_msg_dispatch() {
-    int tail = Q->tail;
-    while (true) {
-        struct message *m = shaco_msg_pop();
-        if (m) {
-            const void *msg = m->msg;
-            shaco_handle_send(m->dest, m->source, m->session, m->type, m->msg, m->sz);
-            shaco_free((void*)msg);
-            if (Q->head == tail)
-                break;
-        } else break;
+    int n;
+    pthread_mutex_lock(&G->lock);
+    n = G->count;
+    pthread_mutex_unlock(&G->lock);
+    while (n-- > 0) {
+        struct shaco_mq *mq = _global_pop(false);
+        if (mq == NULL)
+            break;
+        _dispatch_mq(mq);
     }
 }
 
 int
 shaco_msg_empty() {
-    return Q->tail == Q->head;
+    int empty;
+    pthread_mutex_lock(&G->lock);
+    empty = G->head == NULL;
+    pthread_mutex_unlock(&G->lock);
+    return empty;
 }
 
-void 
-shaco_msg_dispatcher_init() {
-    Q = shaco_malloc(sizeof(*Q));
-    memset(Q, 0, sizeof(*Q));
-    Q->cap = INIT_CAP;
-    Q->head = 0;
-    Q->tail = 0;
-    Q->q = shaco_malloc(sizeof(Q->q[0])*Q->cap);
+int
+shaco_msg_threaded() {
+    return G ? G->nworker : 0;
 }
 
-void 
+static int
+_post(int dest, struct message *m) {
+    struct shaco_context *ctx = shaco_handle_grab(dest);
+    if (ctx == NULL) {
+        shaco_error(NULL,"Context no found: %0x->%0x session:%d type:%d sz:%d",
+                m->source, dest, m->session, m->type & ~SHACO_SHARED, m->sz);
+        _message_free(m);
+        return 1;
+    }
+    _mq_push(shaco_context_mq(ctx), &m->node);
+    shaco_context_release(ctx);
+    return 0;
+}
+
+int
+shaco_msg_post(int dest, int source, int session, int type, const void *msg, int sz) {
+    struct message *m = shaco_malloc(sizeof(*m));
+    m->source = source;
+    m->session = session;
+    m->type = type;
+    m->sz = sz;
+    m->msg = msg;
+    return _post(dest, m);
+}
+
+int
+shaco_msg_postcopy(int dest, int source, int session, int type, const void *msg, int sz) {
+    struct message *m = shaco_malloc(sizeof(*m) + (sz > 0 ? sz : 0));
+    m->source = source;
+    m->session = session;
+    m->type = type;
+    m->sz = sz;
+    if (sz > 0) {
+        memcpy(m->data, msg, sz);
+    }
+    m->msg = m->data;
+    return _post(dest, m);
+}
+
+static void *
+_worker(void *ud) {
+    for (;;) {
+        struct shaco_mq *mq = _global_pop(true);
+        if (mq == NULL)
+            break;
+        _dispatch_mq(mq);
+    }
+    return NULL;
+}
+
+void
+shaco_msg_dispatcher_start() {
+    if (G->nworker <= 0)
+        return;
+    // signal deliver to the main thread only, to break the poll
+    sigset_t set, old;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    G->workers = shaco_malloc(sizeof(G->workers[0]) * G->nworker);
+    int i;
+    for (i=0; i<G->nworker; ++i) {
+        if (pthread_create(&G->workers[i], NULL, _worker, NULL)) {
+            shaco_exit(NULL, "Create worker thread fail");
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void
+shaco_msg_dispatcher_stop() {
+    if (G->workers == NULL)
+        return;
+    pthread_mutex_lock(&G->lock);
+    G->quit = true;
+    pthread_cond_broadcast(&G->cond);
+    pthread_mutex_unlock(&G->lock);
+    int i;
+    for (i=0; i<G->nworker; ++i) {
+        pthread_join(G->workers[i], NULL);
+    }
+    shaco_free(G->workers);
+    G->workers = NULL;
+    G->quit = false;
+}
+
+void
+shaco_msg_dispatcher_init(int nworker, int quota) {
+    G = shaco_malloc(sizeof(*G));
+    memset(G, 0, sizeof(*G));
+    G->nworker = nworker > 0 ? nworker : 0;
+    G->quota = quota > 0 ? quota : 0;
+    pthread_mutex_init(&G->lock, NULL);
+    pthread_cond_init(&G->cond, NULL);
+}
+
+void
 shaco_msg_dispatcher_fini() {
-    if (Q) {
-        shaco_free(Q->q);
-        Q->q = NULL;
-        shaco_free(Q);
-        Q=NULL;
+    if (G) {
+        shaco_msg_dispatcher_stop();
+        struct shaco_mq *mq;
+        while ((mq = _global_pop(false))) {
+            _mq_free(mq);
+        }
+        pthread_cond_destroy(&G->cond);
+        pthread_mutex_destroy(&G->lock);
+        shaco_free(G);
+        G = NULL;
     }
 }
 
@@ -114,20 +384,23 @@ shaco_send(struct shaco_context *ctx, int dest, int session, int type, const voi
             free = true;
         } else
             free = false;
+        // harbor copy it, the sender still hold the shared
+        type &= ~SHACO_SHARED;
         int ret = shaco_harbor_send(dest, source, session, type, msg, sz);
         if (free) {
             shaco_free((void*)msg);
         }
         return ret;
     } else {
-        if (type & SHACO_DONT_COPY) {
+        if (type & SHACO_SHARED) {
+            // one more reader, release after dispatch
+            shaco_shared_grab(msg);
+            return shaco_msg_post(dest, source, session, type, msg, sz);
+        } else if (type & SHACO_DONT_COPY) {
             type &= ~SHACO_DONT_COPY;
+            return shaco_msg_post(dest, source, session, type, msg, sz);
         } else {
-            void *tmp = shaco_malloc(sz);
-            memcpy(tmp, msg, sz);
-            msg = tmp;
+            return shaco_msg_postcopy(dest, source, session, type, msg, sz);
         }
-        shaco_msg_push(dest, source, session, type, msg, sz);
-        return 0;
     }
 }
@@ -1,9 +1,24 @@
 #ifndef __shaco_msg_dispatcher_h__
 #define __shaco_msg_dispatcher_h__
 
-void shaco_msg_dispatcher_init();
+#include <stdint.h>
+
+struct shaco_mq;
+
+void shaco_msg_dispatcher_init(int nworker, int quota);
 void shaco_msg_dispatcher_fini();
+void shaco_msg_dispatcher_start();
+void shaco_msg_dispatcher_stop();
 void shaco_msg_dispatch();
 int shaco_msg_empty();
+int shaco_msg_threaded();
+// post take the msg (shaco_malloc), postcopy copy it, can call from any thread
+int shaco_msg_post(int dest, int source, int session, int type, const void *msg, int sz);
+int shaco_msg_postcopy(int dest, int source, int session, int type, const void *msg, int sz);
+
+struct shaco_mq *shaco_mq_create(uint32_t handle);
+void shaco_mq_schedule(struct shaco_mq *mq);
+void shaco_mq_release(struct shaco_mq *mq);
+int  shaco_mq_length(struct shaco_mq *mq);
 
 #endif
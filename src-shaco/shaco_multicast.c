@@ -0,0 +1,206 @@
+#include "shaco_multicast.h"
+#include "shaco_msg_dispatcher.h"
+#include "shaco_handle.h"
+#include "shaco_context.h"
+#include "shaco_malloc.h"
+#include "shaco.h"
+#include <pthread.h>
+#include <string.h>
+
+#define CHANNEL_HASH_INIT 16
+
+// local channel, the subscriber is handle
+struct channel {
+    struct channel *next;
+    uint32_t id;
+    int cap;
+    int count;
+    uint32_t *subs;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    uint32_t id;
+    int cap;
+    int count;
+    struct channel **slots;
+} *M = NULL;
+
+static struct channel **
+_find(uint32_t id) {
+    struct channel **p = &M->slots[id & (M->cap-1)];
+    while (*p && (*p)->id != id) {
+        p = &(*p)->next;
+    }
+    return p;
+}
+
+static void
+_rehash(int cap) {
+    struct channel **slots = shaco_malloc(sizeof(slots[0]) * cap);
+    memset(slots, 0, sizeof(slots[0]) * cap);
+    int i;
+    for (i=0; i<M->cap; ++i) {
+        struct channel *c = M->slots[i];
+        while (c) {
+            struct channel *next = c->next;
+            struct channel **slot = &slots[c->id & (cap-1)];
+            c->next = *slot;
+            *slot = c;
+            c = next;
+        }
+    }
+    shaco_free(M->slots);
+    M->slots = slots;
+    M->cap = cap;
+}
+
+static inline void
+_channel_free(struct channel *c) {
+    shaco_free(c->subs);
+    shaco_free(c);
+}
+
+uint32_t
+shaco_multicast_create() {
+    pthread_mutex_lock(&M->lock);
+    if (M->count >= M->cap) {
+        _rehash(M->cap*2);
+    }
+    uint32_t id;
+    do {
+        id = ++M->id;
+    } while (id == 0 || *_find(id));
+    struct channel *c = shaco_malloc(sizeof(*c));
+    c->id = id;
+    c->cap = 0;
+    c->count = 0;
+    c->subs = NULL;
+    struct channel **slot = &M->slots[id & (M->cap-1)];
+    c->next = *slot;
+    *slot = c;
+    M->count++;
+    pthread_mutex_unlock(&M->lock);
+    return id;
+}
+
+int
+shaco_multicast_delete(uint32_t id) {
+    pthread_mutex_lock(&M->lock);
+    struct channel **p = _find(id);
+    struct channel *c = *p;
+    if (c) {
+        *p = c->next;
+        M->count--;
+        _channel_free(c);
+    }
+    pthread_mutex_unlock(&M->lock);
+    return c ? 0 : 1;
+}
+
+int
+shaco_multicast_subscribe(uint32_t id, uint32_t handle) {
+    int i;
+    pthread_mutex_lock(&M->lock);
+    struct channel *c = *_find(id);
+    if (c == NULL) {
+        pthread_mutex_unlock(&M->lock);
+        return 1;
+    }
+    for (i=0; i<c->count; ++i) {
+        if (c->subs[i] == handle)
+            break;
+    }
+    if (i == c->count) {
+        if (c->count == c->cap) {
+            c->cap = c->cap ? c->cap*2 : 4;
+            c->subs = shaco_realloc(c->subs, sizeof(c->subs[0]) * c->cap);
+        }
+        c->subs[c->count++] = handle;
+    }
+    pthread_mutex_unlock(&M->lock);
+    return 0;
+}
+
+int
+shaco_multicast_unsubscribe(uint32_t id, uint32_t handle) {
+    int i;
+    pthread_mutex_lock(&M->lock);
+    struct channel *c = *_find(id);
+    if (c == NULL) {
+        pthread_mutex_unlock(&M->lock);
+        return 1;
+    }
+    for (i=0; i<c->count; ++i) {
+        if (c->subs[i] == handle) {
+            c->subs[i] = c->subs[--c->count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&M->lock);
+    return 0;
+}
+
+// deliver the shared payload to every subscriber, the caller still hold
+// its ref, the subscriber gone is removed, return the delivered count
+int
+shaco_multicast_publish(struct shaco_context *ctx, uint32_t id, const void *shared, int sz) {
+    int n = 0;
+    int i;
+    uint32_t source = shaco_context_handle(ctx);
+    pthread_mutex_lock(&M->lock);
+    struct channel *c = *_find(id);
+    if (c == NULL) {
+        pthread_mutex_unlock(&M->lock);
+        return -1;
+    }
+    for (i=0; i<c->count; ) {
+        // the subscriber gone is pruned quietly, the post log the miss
+        struct shaco_context *sub = shaco_handle_grab(c->subs[i]);
+        if (sub == NULL) {
+            c->subs[i] = c->subs[--c->count];
+            continue;
+        }
+        shaco_shared_grab(shared);
+        if (shaco_msg_post(c->subs[i], source, 0, 
+                    SHACO_TMULTICAST|SHACO_SHARED, shared, sz)) {
+            c->subs[i] = c->subs[--c->count];
+        } else {
+            n++;
+            i++;
+        }
+        shaco_context_release(sub);
+    }
+    pthread_mutex_unlock(&M->lock);
+    return n;
+}
+
+void
+shaco_multicast_init() {
+    M = shaco_malloc(sizeof(*M));
+    pthread_mutex_init(&M->lock, NULL);
+    M->id = 0;
+    M->cap = CHANNEL_HASH_INIT;
+    M->count = 0;
+    M->slots = shaco_malloc(sizeof(M->slots[0]) * M->cap);
+    memset(M->slots, 0, sizeof(M->slots[0]) * M->cap);
+}
+
+void
+shaco_multicast_fini() {
+    if (M == NULL)
+        return;
+    int i;
+    for (i=0; i<M->cap; ++i) {
+        struct channel *c = M->slots[i];
+        while (c) {
+            struct channel *next = c->next;
+            _channel_free(c);
+            c = next;
+        }
+    }
+    shaco_free(M->slots);
+    pthread_mutex_destroy(&M->lock);
+    shaco_free(M);
+    M = NULL;
+}
@@ -0,0 +1,17 @@
+#ifndef __shaco_multicast_h__
+#define __shaco_multicast_h__
+
+#include <stdint.h>
+
+struct shaco_context;
+
+void shaco_multicast_init();
+void shaco_multicast_fini();
+
+uint32_t shaco_multicast_create();
+int  shaco_multicast_delete(uint32_t id);
+int  shaco_multicast_subscribe(uint32_t id, uint32_t handle);
+int  shaco_multicast_unsubscribe(uint32_t id, uint32_t handle);
+int  shaco_multicast_publish(struct shaco_context *ctx, uint32_t id, const void *shared, int sz);
+
+#endif
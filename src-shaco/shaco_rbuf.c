@@ -0,0 +1,137 @@
+#include "shaco_rbuf.h"
+#include "shaco_malloc.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define RBUF_MIN_SHIFT 5  // 32 byte, the socketbuffer node can use it too
+#define RBUF_MAX_SHIFT 16 // 64K
+#define RBUF_CLASS (RBUF_MAX_SHIFT-RBUF_MIN_SHIFT+1)
+
+struct free_node {
+    struct free_node *next;
+};
+
+struct rbuf_class {
+    pthread_mutex_t lock;
+    int count;
+    int max;
+    struct free_node *head;
+    uint64_t hit;
+    uint64_t miss;
+    uint64_t recycle;
+    uint64_t drop;
+};
+
+static struct {
+    struct rbuf_class c[RBUF_CLASS];
+} *P = NULL;
+
+static inline int
+_shift(size_t size) {
+    int shift = RBUF_MIN_SHIFT;
+    while (((size_t)1 << shift) < size)
+        shift++;
+    return shift;
+}
+
+void *
+shaco_rbuf_alloc(int size) {
+    if (P == NULL || size > (1 << RBUF_MAX_SHIFT))
+        return shaco_malloc(size);
+    int shift = _shift(size);
+    struct rbuf_class *c = &P->c[shift-RBUF_MIN_SHIFT];
+    pthread_mutex_lock(&c->lock);
+    struct free_node *n = c->head;
+    if (n) {
+        c->head = n->next;
+        c->count--;
+        c->hit++;
+    } else {
+        c->miss++;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return n ? (void*)n : shaco_malloc((size_t)1 << shift);
+}
+
+void
+shaco_rbuf_free(void *p) {
+    if (p == NULL)
+        return;
+    if (P) {
+        size_t size = shaco_malloc_size(p);
+        if (size >= (1 << RBUF_MIN_SHIFT) && 
+            size <= (1 << RBUF_MAX_SHIFT) && 
+            (size & (size-1)) == 0) {
+            struct rbuf_class *c = &P->c[_shift(size)-RBUF_MIN_SHIFT];
+            bool full;
+            pthread_mutex_lock(&c->lock);
+            full = c->count >= c->max;
+            if (full) {
+                c->drop++;
+            } else {
+                struct free_node *n = p;
+                n->next = c->head;
+                c->head = n;
+                c->count++;
+                c->recycle++;
+            }
+            pthread_mutex_unlock(&c->lock);
+            if (!full)
+                return;
+        }
+    }
+    shaco_free(p);
+}
+
+void
+shaco_rbuf_stat(struct shaco_rbuf_stat *st) {
+    memset(st, 0, sizeof(*st));
+    if (P == NULL)
+        return;
+    int i;
+    for (i=0; i<RBUF_CLASS; ++i) {
+        struct rbuf_class *c = &P->c[i];
+        pthread_mutex_lock(&c->lock);
+        st->hit += c->hit;
+        st->miss += c->miss;
+        st->recycle += c->recycle;
+        st->drop += c->drop;
+        st->cached += c->count;
+        st->cached_bytes += (size_t)c->count << (i+RBUF_MIN_SHIFT);
+        pthread_mutex_unlock(&c->lock);
+    }
+}
+
+void
+shaco_rbuf_init(size_t max_class_bytes) {
+    P = shaco_malloc(sizeof(*P));
+    memset(P, 0, sizeof(*P));
+    int i;
+    for (i=0; i<RBUF_CLASS; ++i) {
+        struct rbuf_class *c = &P->c[i];
+        pthread_mutex_init(&c->lock, NULL);
+        // at least a few for the big class
+        c->max = max_class_bytes >> (i+RBUF_MIN_SHIFT);
+        if (c->max < 4 && max_class_bytes > 0)
+            c->max = 4;
+    }
+}
+
+void
+shaco_rbuf_fini() {
+    if (P == NULL)
+        return;
+    int i;
+    for (i=0; i<RBUF_CLASS; ++i) {
+        struct rbuf_class *c = &P->c[i];
+        while (c->head) {
+            struct free_node *n = c->head;
+            c->head = n->next;
+            shaco_free(n);
+        }
+        pthread_mutex_destroy(&c->lock);
+    }
+    shaco_free(P);
+    P = NULL;
+}
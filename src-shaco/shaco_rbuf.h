@@ -0,0 +1,28 @@
+#ifndef __shaco_rbuf_h__
+#define __shaco_rbuf_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// receive buffer pool, size classed by power of 2, thread safe.
+// shaco_rbuf_free can free any shaco_malloc memory, the one with class
+// size is kept for reuse, so the socket data can be freed by it whoever
+// allocate it
+struct shaco_rbuf_stat {
+    uint64_t hit;     // alloc from pool
+    uint64_t miss;    // alloc from malloc
+    uint64_t recycle; // free to pool
+    uint64_t drop;    // free to malloc, the pool is full or no class
+    int cached;
+    size_t cached_bytes;
+};
+
+void shaco_rbuf_init(size_t max_class_bytes);
+void shaco_rbuf_fini();
+
+// the buffer size is round up to the class size, if it is in classes
+void *shaco_rbuf_alloc(int size);
+void  shaco_rbuf_free(void *p);
+void  shaco_rbuf_stat(struct shaco_rbuf_stat *st);
+
+#endif
@@ -1,26 +1,113 @@
 #include "shaco_socket.h"
+#include "shaco_msg_dispatcher.h"
 #include "socket.h"
 #include "shaco.h"
 #include <stdlib.h>
+#include <string.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include <pthread.h>
 
 static struct net* N = NULL;
+static int DEFER = 0;
+
+// net is shared by worker threads, the poll wait is out of lock
+static pthread_mutex_t LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+#define _LOCKED(expr) ({ \
+    pthread_mutex_lock(&LOCK); \
+    int __r = (expr); \
+    pthread_mutex_unlock(&LOCK); \
+    __r; })
+
+// copy the message for the mailbox, accept addr point to the net buffer
+static struct socket_message *
+_copy_message(struct socket_message *msg) {
+    int extra = msg->type == SOCKET_TYPE_ACCEPT ? msg->size : 0;
+    struct socket_message *m = shaco_malloc(sizeof(*m) + extra);
+    *m = *msg;
+    if (extra > 0) {
+        memcpy(m+1, msg->data, extra);
+        m->data = m+1;
+    }
+    return m;
+}
+
+static inline void
+_forward(struct socket_message *msg, struct socket_message *copy) {
+    if (copy) {
+        shaco_msg_post(copy->ud, 0, 0, SHACO_TSOCKET, copy, sizeof(*copy));
+    } else {
+        shaco_handle_send(msg->ud, 0, 0, SHACO_TSOCKET, msg, sizeof(*msg));
+    }
+}
 
 void
 shaco_socket_poll(int timeout) {
-    int more = 1;
     struct socket_message msg;
-    while (socket_poll(N, timeout, &msg, &more)) {
-        int handle = msg.ud;
-        shaco_handle_send(handle, 0, 0, SHACO_TSOCKET, &msg, sizeof(msg));
-        if (!more) break;
+    struct socket_message *copy;
+    int threaded = shaco_msg_threaded();
+    pthread_mutex_lock(&LOCK);
+    int more = socket_pending(N);
+    pthread_mutex_unlock(&LOCK);
+    int n = socket_wait(N, timeout, more);
+    pthread_mutex_lock(&LOCK);
+    socket_tick(N);
+    pthread_mutex_unlock(&LOCK);
+    while (n > 0) {
+        copy = NULL;
+        int more = 0;
+        pthread_mutex_lock(&LOCK);
+        int ok = socket_poll(N, 0, &msg, &more);
+        if (!more)
+            n--;
+        if (ok && threaded) {
+            copy = _copy_message(&msg);
+        }
+        pthread_mutex_unlock(&LOCK);
+        if (ok) {
+            _forward(&msg, copy);
+        }
+    }
+}
+
+// write the deferred send, once per loop
+void
+shaco_socket_flush() {
+    struct socket_message msg;
+    struct socket_message *copy;
+    int threaded = shaco_msg_threaded();
+    if (!DEFER)
+        return;
+    for (;;) {
+        copy = NULL;
+        pthread_mutex_lock(&LOCK);
+        int ok = socket_flush(N, &msg);
+        if (ok && threaded) {
+            copy = _copy_message(&msg);
+        }
+        pthread_mutex_unlock(&LOCK);
+        if (!ok)
+            break;
+        _forward(&msg, copy);
     }
 }
 
+void
+shaco_socket_wakeup() {
+    if (N) {
+        socket_wakeup(N);
+    }
+}
+
+int
+shaco_socket_settimer(uint64_t usec) {
+    return N ? _LOCKED(socket_settimer(N, usec)) : 1;
+}
+
 int 
 shaco_socket_psend(struct shaco_context *ctx, int id, void *data, int sz) {
-    int n = socket_send(N, id, data, sz);
+    int n = _LOCKED(socket_send(N, id, data, sz));
     if (n < 0) {
         int handle = shaco_context_handle(ctx);
         struct socket_message msg;
@@ -43,6 +130,13 @@ shaco_socket_init(int max_socket) {
     if (N == NULL) {
         shaco_exit(NULL, "net_create fail, max=%d", max);
     }
+    socket_listenopt(N, shaco_optint("backlog", 0), shaco_optint("acceptbatch", 0));
+    if (socket_edge(N, shaco_optint("edge", 0))) {
+        shaco_warn(NULL, "Edge triggered is not supported by the network backend");
+    }
+    DEFER = shaco_optint("senddefer", 0);
+    // the worker send in deferred, wakeup the loop from poll to flush it
+    socket_defer(N, DEFER, shaco_optint("thread", 0) > 0);
 }
 
 void
@@ -55,29 +149,42 @@ shaco_socket_fini() {
 
 int 
 shaco_socket_bind(struct shaco_context *ctx, int fd, int protocol) {
-    return socket_bind(N, fd, shaco_context_handle(ctx), protocol);
+    return _LOCKED(socket_bind(N, fd, shaco_context_handle(ctx), protocol));
 }
 int 
-shaco_socket_listen(struct shaco_context *ctx, const char *addr, int port) { 
-    return socket_listen(N, addr, port, shaco_context_handle(ctx)); 
+shaco_socket_listen(struct shaco_context *ctx, const char *addr, int port, int reuseport) { 
+    return _LOCKED(socket_listen(N, addr, port, shaco_context_handle(ctx), reuseport));
 }
 int 
 shaco_socket_connect(struct shaco_context *ctx, const char* addr, int port, int *conning) { 
-    return socket_connect(N, addr, port, 0, shaco_context_handle(ctx), conning);
+    return _LOCKED(socket_connect(N, addr, port, 0, shaco_context_handle(ctx), conning));
 }
 
 int 
 shaco_socket_blockconnect(struct shaco_context *ctx, const char *addr, int port) { 
-    return socket_connect(N, addr, port, 1, shaco_context_handle(ctx), NULL); 
+    return _LOCKED(socket_connect(N, addr, port, 1, shaco_context_handle(ctx), NULL));
+}
+
+int
+shaco_socket_udp(struct shaco_context *ctx, const char *addr, int port) {
+    return _LOCKED(socket_udp(N, addr, port, shaco_context_handle(ctx)));
 }
 
 int
 shaco_socket_start(struct shaco_context *ctx, int id) {
-    return socket_udata(N, id, shaco_context_handle(ctx));
+    return _LOCKED(socket_udata(N, id, shaco_context_handle(ctx)));
 }
 
-int shaco_socket_close(int id, int force) { return socket_close(N, id, force); }
-int shaco_socket_enableread(int id, int read) { return socket_enableread(N, id, read); }
-int shaco_socket_send(int id, void *data, int sz) { return socket_send(N, id, data, sz); }
-int shaco_socket_sendfd(int id, void *data, int sz, int fd) { return socket_sendfd(N, id, data, sz, fd); }
-int shaco_socket_fd(int id) { return socket_fd(N, id); }
+int shaco_socket_close(int id, int force) { return _LOCKED(socket_close(N, id, force)); }
+int shaco_socket_enableread(int id, int read) { return _LOCKED(socket_enableread(N, id, read)); }
+int shaco_socket_watermark(int id, int high, int low) { return _LOCKED(socket_watermark(N, id, high, low)); }
+int shaco_socket_readlimit(int id, int high, int low) { return _LOCKED(socket_readlimit(N, id, high, low)); }
+int shaco_socket_zerocopy(int id, int threshold) { return _LOCKED(socket_zerocopy(N, id, threshold)); }
+int shaco_socket_consumed(int id, int size) { return _LOCKED(socket_consumed(N, id, size)); }
+int shaco_socket_send(int id, void *data, int sz) { return _LOCKED(socket_send(N, id, data, sz)); }
+int shaco_socket_sendfd(int id, void *data, int sz, int fd) { return _LOCKED(socket_sendfd(N, id, data, sz, fd)); }
+int shaco_socket_fd(int id) { return _LOCKED(socket_fd(N, id)); }
+int shaco_socket_stat(int id, struct socket_stat *st) { return _LOCKED(socket_stat(N, id, st)); }
+int shaco_socket_top(int by, struct socket_stat *st, int n) { return _LOCKED(socket_top(N, by, st, n)); }
+int shaco_socket_udpconnect(int id, const char *addr, int port) { return _LOCKED(socket_udpconnect(N, id, addr, port)); }
+int shaco_socket_udpsend(int id, const uint8_t *udpaddr, void *data, int sz) { return _LOCKED(socket_udpsend(N, id, udpaddr, data, sz)); }
@@ -9,16 +9,28 @@ void shaco_socket_init(int max_socket);
 void shaco_socket_fini();
 
 int shaco_socket_bind(struct shaco_context *ctx, int fd, int protocol);
-int shaco_socket_listen(struct shaco_context *ctx, const char *addr, int port);
+int shaco_socket_listen(struct shaco_context *ctx, const char *addr, int port, int reuseport);
 int shaco_socket_connect(struct shaco_context *ctx, const char *addr, int port, int *conning);
 int shaco_socket_blockconnect(struct shaco_context *ctx, const char *addr, int port);
+int shaco_socket_udp(struct shaco_context *ctx, const char *addr, int port);
+int shaco_socket_udpconnect(int id, const char *addr, int port);
+int shaco_socket_udpsend(int id, const uint8_t *udpaddr, void *data, int sz);
 int shaco_socket_start(struct shaco_context *ctx, int id);
 int shaco_socket_psend(struct shaco_context *ctx, int id, void *data, int sz);
 int shaco_socket_close(int id, int force);
 int shaco_socket_enableread(int id, int read);
+int shaco_socket_watermark(int id, int high, int low);
+int shaco_socket_readlimit(int id, int high, int low);
+int shaco_socket_zerocopy(int id, int threshold);
+int shaco_socket_consumed(int id, int size);
 void shaco_socket_poll(int timeout);
+void shaco_socket_flush();
+void shaco_socket_wakeup();
+int shaco_socket_settimer(uint64_t usec);
 int shaco_socket_send(int id, void *data, int sz);
 int shaco_socket_sendfd(int id, void *data, int size, int fd);
 int shaco_socket_fd(int id);
+int shaco_socket_stat(int id, struct socket_stat *st);
+int shaco_socket_top(int by, struct socket_stat *st, int n);
 
 #endif
@@ -1,78 +1,36 @@
 #include "shaco.h"
 #include "shaco_malloc.h"
+#include "shaco_msg_dispatcher.h"
+#include "shaco_socket.h"
+#include "socket_alloc.h"
+#include "timer_queue.h"
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #if defined(__APPLE__)
 #include <sys/time.h>
 #endif
 
-struct time_node {
-    uint32_t handle;
-    int session;
-    int interval;
-    uint64_t expire;
-};
-
-struct time_heap {
-    int cap;
-    int sz;
-    struct time_node *p;
-};
-
-static void 
-time_push(struct time_heap *h, struct time_node *n) {
-    if (h->sz == h->cap) {
-        if (h->cap == 0)
-            h->cap = 1;
-        else
-            h->cap *= 2; 
-        h->p = shaco_realloc(h->p, sizeof(h->p[0]) * h->cap);
-    }
-    int pos = h->sz;
-    while (pos>0) {
-        int up = (pos-1)/2;
-        if (n->expire < h->p[up].expire)
-            h->p[pos] = h->p[up];
-        else break;
-        pos=up;
-    }
-    h->p[pos] = *n;
-    h->sz++;     
-}
-
-static void
-time_pop(struct time_heap *h, struct time_node* n) {
-    *n = h->p[0];
-    int last = --h->sz;
-    if (last > 0) {
-        uint64_t down = h->p[last--].expire;
-        int i = 0;
-        int child = 1;
-        while (child <= last) {
-            if (child < last)
-                if (h->p[child].expire > h->p[child+1].expire)
-                    child++;
-            if (down >= h->p[child].expire)
-                h->p[i] = h->p[child];
-            else break;
-            i = child;
-            child = i*2+1;
-        }
-        h->p[i] = h->p[last+1];
-    }
-}
-
 struct sh_timer {
     uint64_t start_time;
     uint64_t machine_start_time;
     uint64_t machine_elapsed_time;
     bool dirty;
+    bool wheel;
+    bool hires;    // the queue time unit is usec, else msec
+    bool notimerfd;
+    uint64_t armed; // the timerfd expire
+    uint64_t start_time_us;
+    uint64_t deadline; // the main loop wait until
+    pthread_mutex_t lock;
+    struct time_pool pool;
     struct time_heap h;
+    struct time_wheel *w;
 };
 
 static struct sh_timer* T = NULL;
@@ -103,6 +61,20 @@ _elapsed() {
 #endif
 }
 
+// usec, same clock as the timerfd
+static uint64_t
+_elapsed_us() {
+#if !defined(__APPLE__)
+    struct timespec ti;
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+    return (uint64_t)ti.tv_sec * 1000000 + (uint64_t)ti.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+#endif
+}
+
 static void
 _elapsed_time() {
     if (T->dirty) {
@@ -111,6 +83,23 @@ _elapsed_time() {
     }
 }
 
+// the cached elapsed time is for the main loop only
+static uint64_t
+_current() {
+    if (shaco_msg_threaded()) {
+        return _elapsed();
+    } else {
+        _elapsed_time();
+        return T->machine_elapsed_time;
+    }
+}
+
+// the time of the timer queue
+static inline uint64_t
+_queue_now() {
+    return T->hires ? _elapsed_us() : _current();
+}
+
 uint64_t
 shaco_timer_start_time() {
     return T->start_time;
@@ -118,8 +107,7 @@ shaco_timer_start_time() {
 
 uint64_t 
 shaco_timer_now() {
-    _elapsed_time();
-    return T->machine_start_time + T->machine_elapsed_time;
+    return T->machine_start_time + _current();
 }
 
 uint64_t 
@@ -127,19 +115,71 @@ shaco_timer_time() {
     return T->machine_start_time + _elapsed();
 }
 
+uint64_t
+shaco_timer_now_us() {
+    return T->start_time_us + _elapsed_us();
+}
+
+// wait until the expire by timerfd, return -1 for the poll, or the msec
+// timeout if no timerfd
+static int
+_hires_timeout(uint64_t expire, uint64_t now) {
+    if (!T->notimerfd) {
+        if (expire == T->armed)
+            return -1;
+        if (shaco_socket_settimer(expire) == 0) {
+            T->armed = expire;
+            return -1;
+        }
+        T->notimerfd = true;
+    }
+    return (expire - now + 999) / 1000;
+}
+
 int
 shaco_timer_max_timeout() {
     T->machine_elapsed_time = _elapsed(); 
     T->dirty = true;
     
-    struct time_heap *h = &T->h;
-    if (h->sz > 0) {
-        uint64_t expire = h->p[0].expire;
-        return expire > T->machine_elapsed_time ?
-            expire - T->machine_elapsed_time : 0;
+    int timeout;
+    pthread_mutex_lock(&T->lock);
+    if (T->wheel) {
+        timeout = time_wheel_timeout(T->w, T->machine_elapsed_time);
+        T->deadline = timeout >= 0 ? T->machine_elapsed_time + timeout : UINT64_MAX;
     } else {
-        return -1;
+        struct time_node *n = time_heap_top(&T->h);
+        uint64_t now = T->hires ? _elapsed_us() : T->machine_elapsed_time;
+        if (n) {
+            if (n->expire <= now)
+                timeout = 0;
+            else if (T->hires)
+                timeout = _hires_timeout(n->expire, now);
+            else
+                timeout = n->expire - now;
+        } else {
+            timeout = -1;
+        }
     }
+    pthread_mutex_unlock(&T->lock);
+    return timeout;
+}
+
+// requeue the repeat timer, base on the last expire so no drift,
+// skip the missed ones if the loop is late, return 0 if the context is gone
+static int
+_rearm(struct time_node *n, uint64_t now) {
+    struct shaco_context *ctx = shaco_handle_grab(n->handle);
+    if (ctx == NULL)
+        return 0;
+    shaco_context_release(ctx);
+    n->expire += n->interval;
+    if (n->expire <= now)
+        n->expire += ((now - n->expire) / n->interval + 1) * n->interval;
+    if (T->wheel)
+        time_wheel_add(T->w, n);
+    else
+        time_heap_push(&T->h, n);
+    return 1;
 }
 
 void
@@ -147,28 +187,113 @@ shaco_timer_trigger() {
     //T->dirty = true;
     _elapsed_time();
     
-    struct time_heap *h = &T->h;
-    while (h->sz) {
-        if (h->p[0].expire <= T->machine_elapsed_time) {
-            struct time_node n;
-            time_pop(h, &n);
-            shaco_handle_send(n.handle, 0, n.session, SHACO_TTIME, NULL, 0);
-        } else {
+    uint64_t now = T->hires ? _elapsed_us() : T->machine_elapsed_time;
+    bool threaded = shaco_msg_threaded();
+    for (;;) {
+        struct time_node *n;
+        uint32_t handle = 0;
+        int session = 0;
+        // send out of lock, the callback may register or cancel timer
+        pthread_mutex_lock(&T->lock);
+        if (T->wheel)
+            n = time_wheel_pop(T->w, now);
+        else
+            n = time_heap_pop(&T->h, now);
+        if (n) {
+            handle = n->handle;
+            session = n->session;
+            if (!n->repeat) {
+                time_node_free(&T->pool, n);
+            } else if (!_rearm(n, now)) {
+                time_node_free(&T->pool, n);
+                handle = 0;
+            } else if (threaded) {
+                // post in lock, keep order with the last one by cancel
+                shaco_handle_send(handle, 0, session, SHACO_TTIME, NULL, 0);
+                handle = 0;
+            }
+        }
+        pthread_mutex_unlock(&T->lock);
+        if (n == NULL)
             break;
+        if (handle) {
+            shaco_handle_send(handle, 0, session, SHACO_TTIME, NULL, 0);
         }
     }
 }
 
-void
+static uint64_t
+_register(uint32_t handle, int session, uint64_t usec, bool repeat) {
+    if (usec == 0 && shaco_msg_threaded()) {
+        // keep order with the message in mailbox, eg. shaco.start in init
+        shaco_msg_post(handle, 0, session, SHACO_TTIME, NULL, 0);
+        return 0;
+    }
+    // round up to msec if not hires
+    uint64_t interval = T->hires ? usec : (usec + 999) / 1000;
+    // 0 is due at once, fire before the message in mailbox in this turn
+    uint64_t expire = interval > 0 ? _queue_now() + interval : 0;
+    uint64_t id;
+    bool first;
+    pthread_mutex_lock(&T->lock);
+    struct time_node *n = time_node_alloc(&T->pool);
+    n->handle = handle;
+    n->session = session;
+    n->interval = interval;
+    n->repeat = repeat;
+    n->expire = expire;
+    id = TIME_NODE_ID(n);
+    if (T->wheel) {
+        time_wheel_add(T->w, n);
+        first = expire < T->deadline;
+    } else {
+        time_heap_push(&T->h, n);
+        first = n->index == 0;
+    }
+    pthread_mutex_unlock(&T->lock);
+    if (first) {
+        // the poll may wait longer, eg. register in worker thread
+        shaco_wakeup();
+    }
+    return id;
+}
+
+uint64_t
 shaco_timer_register(uint32_t handle, int session, int interval) {
-    _elapsed_time();
-    
-    struct time_node n;
-    n.handle = handle;
-    n.session = session;
-    n.interval = interval;
-    n.expire = T->machine_elapsed_time + interval;
-    time_push(&T->h, &n);
+    return _register(handle, session, interval > 0 ? (uint64_t)interval * 1000 : 0, false);
+}
+
+uint64_t
+shaco_timer_register_us(uint32_t handle, int session, uint64_t usec) {
+    return _register(handle, session, usec, false);
+}
+
+uint64_t
+shaco_timer_repeat(uint32_t handle, int session, int interval) {
+    if (interval <= 0)
+        return 0;
+    return _register(handle, session, (uint64_t)interval * 1000, true);
+}
+
+int
+shaco_timer_cancel(uint64_t id) {
+    int ret = 1;
+    pthread_mutex_lock(&T->lock);
+    struct time_node *n = time_node_find(&T->pool, id);
+    if (n) {
+        if (T->wheel)
+            time_wheel_remove(T->w, n);
+        else
+            time_heap_remove(&T->h, n);
+        if (n->repeat) {
+            // the ticks before may be in the mailbox, tell it is the end
+            shaco_msg_postcopy(n->handle, 0, n->session, SHACO_TTIME, NULL, -1);
+        }
+        time_node_free(&T->pool, n);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&T->lock);
+    return ret;
 }
 
 void
@@ -179,16 +304,39 @@ shaco_timer_init() {
     T->start_time = _now();
     T->machine_elapsed_time = _elapsed(); 
     T->machine_start_time = T->start_time - T->machine_elapsed_time;
+#if !defined(__APPLE__)
+    struct timespec ti;
+    clock_gettime(CLOCK_REALTIME, &ti);
+    T->start_time_us = (uint64_t)ti.tv_sec * 1000000 + (uint64_t)ti.tv_nsec / 1000 - _elapsed_us();
+#else
+    T->start_time_us = T->start_time * 1000 - _elapsed_us();
+#endif
+    pthread_mutex_init(&T->lock, NULL);
     memset(&T->h, 0, sizeof(T->h));
+    // heap or wheel, wheel is O(1) for lots of timer
+    T->wheel = strcmp(shaco_optstr("timer", "heap"), "wheel") == 0;
+    // usec expire and poll wait by timerfd, use the heap,
+    // the wheel would step every usec
+    T->hires = shaco_optint("hrtimer", 0) != 0;
+    if (T->hires)
+        T->wheel = false;
+    T->deadline = UINT64_MAX;
+    if (T->wheel) {
+        T->w = shaco_malloc(sizeof(*T->w));
+        time_wheel_init(T->w, T->machine_elapsed_time);
+    }
 }
 
 void 
 shaco_timer_fini() {
     if (T) {
-        if (T->h.p) {
-            shaco_free(T->h.p);
-            T->h.p = NULL;
+        time_heap_fini(&T->h);
+        if (T->w) {
+            shaco_free(T->w);
+            T->w = NULL;
         }
+        time_pool_fini(&T->pool);
+        pthread_mutex_destroy(&T->lock);
         shaco_free(T);
         T = NULL;
     }
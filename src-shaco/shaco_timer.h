@@ -8,9 +8,18 @@ void shaco_timer_fini();
 
 int shaco_timer_max_timeout();
 void shaco_timer_trigger();
-void shaco_timer_register(uint32_t handle, int session, int interval);
+// return the timer id, 0 if it is posted already and can not cancel
+uint64_t shaco_timer_register(uint32_t handle, int session, int interval);
+// usec interval, round up to msec if the hrtimer option is off
+uint64_t shaco_timer_register_us(uint32_t handle, int session, uint64_t usec);
+// fire every interval until cancel, cancel post the last SHACO_TTIME
+// with sz -1, no more message for the session after that
+uint64_t shaco_timer_repeat(uint32_t handle, int session, int interval);
+// return 0 if cancelled, 1 if it is expired or no found
+int shaco_timer_cancel(uint64_t id);
 uint64_t shaco_timer_start_time();
 uint64_t shaco_timer_now();
 uint64_t shaco_timer_time();
+uint64_t shaco_timer_now_us();
 
 #endif
@@ -1,3 +1,6 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // accept4
+#endif
 #include "socket_alloc.h"
 #include "socket_platform.h"
 #include "socket.h"
@@ -7,6 +10,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
+#include <stddef.h>
 
 #define STATUS_INVALID    -1
 #define STATUS_LISTENING   1 
@@ -16,12 +20,30 @@
 #define STATUS_SUSPEND     5
 #define STATUS_OPENED      STATUS_LISTENING
 #define STATUS_BIND        6
+#define STATUS_WAKEUP      7
+#define STATUS_TIMER       8
 
+#define SOCKET_CHUNK 4096 // the socket table grow by the chunk, up to max
+#define SOCKET_MAX (1<<24) // keep 7 bits for the generation of the id
+#define EVENT_BATCH 1024 // max events for one np poll
 #define LISTEN_BACKLOG 511
+#define ACCEPT_BATCH 64
 #define RBUFFER_SZ 64
 #define RECVMSG_MAXSIZE 64
+#define UDP_BATCH 32 // datagrams for one recvmmsg/sendmmsg
+#define UDP_RECV_MAXSIZE 4096 // the larger datagram is truncated and dropped
+#define PACKET_MAXSIZE 65536 // the larger seqpacket message is an error
+#define ZEROCOPY_WINDOW 256 // zerocopy send in flight, more is copied
+#define ZEROCOPY_LINGER 10000 // ms, keep the buffer of the closed socket
+#define UDPADDR_V4 1
+#define UDPADDR_V6 2
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
-#define sockid(s) ((s)-self->sockets)
+// the socket id is generation | index, the stale id of the closed socket
+// never reach the reused one
+#define sockid(s) ((s)->id)
 
 struct sbuffer {
     struct sbuffer *next;
@@ -29,11 +51,40 @@ struct sbuffer {
     int fd; // for ipc
     char *begin;
     char *ptr;
+    uint8_t udpaddr[0]; // udp only, the dest address follow
+};
+
+// the buffer sent by MSG_ZEROCOPY, free it when the kernel complete
+struct zbuffer {
+    struct zbuffer *next;
+    uint32_t seq; // the last zerocopy send use it
+    uint64_t expire; // the socket is closed, no completion, free at the time
+    void *data;
+};
+
+union sockaddr_all {
+    struct sockaddr s;
+    struct sockaddr_in v4;
+    struct sockaddr_in6 v6;
+};
+
+// the datagrams received by one batch, socket_poll return them one by one
+struct udp_recv {
+    struct socket *s;
+    int count;
+    int index;
+    int size[UDP_BATCH];
+    int flags[UDP_BATCH];
+    union sockaddr_all addr[UDP_BATCH];
+    char buffer[UDP_BATCH][UDP_RECV_MAXSIZE];
 };
 
 struct socket {
+    int id;
     socket_t fd;
     int protocol;
+    int packet; // unix seqpacket, one message for one read or write
+    int udp6; // udp on AF_INET6, the v4 address is sent as v4 mapped
     int status;
     int mask;
     int ud;
@@ -41,62 +92,200 @@ struct socket {
     struct sbuffer *tail; 
     int sbuffersz;
     int rbuffersz;
+    int flush; // in the flush list, keep it over close, the list hold it
+    struct socket *flush_next;
+    int edge; // add to np edge triggered
+    int ready; // in the ready list, read again before the next np poll
+    struct socket *ready_next;
+    int whigh; // send buffer watermark, 0 for none
+    int wlow;
+    int blocked; // over whigh, until drop to wlow
+    int notify; // in the notify list to report blocked
+    struct socket *notify_next;
+    int rhigh; // unconsumed read watermark, 0 for none
+    int rlow;
+    int rpending; // read but not consumed by the reader
+    int rpaused; // read off by rhigh, until consumed to rlow
+    struct socket *free_next;
+    uint64_t rbytes; // the io stat, see socket_stat
+    uint64_t wbytes;
+    uint64_t rcount;
+    uint64_t wcount;
+    uint64_t ctime; // create time
+    uint64_t atime; // last read or write time
+    uint64_t mark; // bytes at the last socket_top
+    int zerocopy; // send the buffer not less than it by MSG_ZEROCOPY, 0 for none
+    int zused; // the head buffer is sent by zerocopy partly
+    uint32_t zseq; // the next zerocopy send
+    uint32_t zdone; // all the zerocopy send before it are completed
+    uint8_t *zring; // completed flag of the send in flight, ZEROCOPY_WINDOW
+    struct zbuffer *zhead; // wait the completion
+    struct zbuffer *ztail;
+    uint64_t zbytes; // sent by zerocopy
+    uint64_t zcopied; // the completion copied by the kernel
 };
 
 struct net {
     struct np_state np;
     int max;
+    int index_bits; // of the socket id, the rest is the generation
+    int batch;
     struct np_event *events;
     int event_count;
     int event_index;
-    struct socket *sockets;
+    struct socket **chunks;
+    int nsocket; // allocated by the chunk
     struct socket *free_socket;
     struct socket *tail_socket;
+    struct socket wakeup;
+    int wakeup_fd;
+    int wakeup_pending;
+    struct socket timer;
+    int defer; // queue the send, write in socket_flush
+    int defer_wakeup; // the flush loop may wait in poll
+    struct socket *flush_head;
+    int edge; // edge triggered for the data socket
+    int backlog;
+    int accept_batch; // max accepted for one listen event
+    int accepted;
+    int ready_count;
+    struct socket *ready_head;
+    struct socket *ready_tail;
+    int notify_count;
+    struct socket *notify_head;
+    struct socket *notify_tail;
+    struct udp_recv *udp; // the udp batch received
+    char *packet; // alloc for the first seqpacket read
+    struct zbuffer *zlinger; // of the closed socket
+    struct zbuffer *zlinger_tail;
+    uint64_t now; // ms, update after np poll
+    uint64_t top_time; // the last socket_top, for the throughput
     char recvmsg_buffer[RECVMSG_MAXSIZE];
     char buffer[128];
 };
 
+static inline struct socket *
+_slot(struct net *self, int index) {
+    return &self->chunks[index/SOCKET_CHUNK][index%SOCKET_CHUNK];
+}
+
 static inline struct socket *
 _socket(struct net *self, int id) {
-    assert(id>=0 && id<self->max);
-    struct socket *s = &self->sockets[id];
-    if (s->status != STATUS_INVALID) 
+    int index = id & ((1<<self->index_bits)-1);
+    if (id < 0 || index >= self->nsocket)
+        return NULL;
+    struct socket *s = _slot(self, index);
+    if (s->id == id && s->status != STATUS_INVALID) 
         return s;
     else return NULL;
 }
 
+// the data socket, read and write until EAGAIN in the edge mode
+static inline int
+_edge(struct net *self, struct socket *s) {
+    if (s->edge)
+        return 1;
+    return self->edge &&
+        (s->status == STATUS_CONNECTED ||
+         s->status == STATUS_HALFCLOSE ||
+         s->status == STATUS_BIND);
+}
+
 static int
 _subscribe(struct net *self, struct socket *s, int mask) {
     int result;
+#ifdef NP_COMPLETION
+    // let np accept and recv for the tcp socket
+    if (mask & NP_RABLE) {
+        if (s->status == STATUS_LISTENING)
+            mask |= NP_ACCEPT;
+        else if (s->protocol == SOCKET_PROTOCOL_TCP && !s->packet &&
+                (s->status == STATUS_CONNECTED || s->status == STATUS_HALFCLOSE))
+            mask |= NP_RECV;
+    }
+#endif
     if (mask == s->mask)
         return 0;
+    if (_edge(self, s)) {
+        // keep the write armed, only the read toggle need np
+        int events = (mask & NP_RABLE)|NP_WABLE|NP_EDGE;
+        if (!s->edge)
+            result = np_add(&self->np, s->fd, events, s);
+        else if ((mask ^ s->mask) & NP_RABLE)
+            result = np_mod(&self->np, s->fd, events, s);
+        else
+            result = 0;
+        if (result == 0) {
+            s->edge = 1;
+            s->mask = mask;
+        }
+        return result;
+    }
+#ifdef NP_COMPLETION
+    // np_del drop the data recv inflight, it is for the close only
+    result = np_mod(&self->np, s->fd, mask, s);
+#else
     if (mask == 0)
         result = np_del(&self->np, s->fd);
     else if (s->mask == 0)
         result = np_add(&self->np, s->fd, mask, s);
     else
         result = np_mod(&self->np, s->fd, mask, s);
+#endif
     if (result == 0)
         s->mask = mask;
     return result;
 }
 
-static struct socket*
-_alloc_sockets(int max) {
-    assert(max > 0);
+// alloc the next chunk to the free list, return 1 if the table is full
+static int
+_alloc_sockets(struct net *self) {
+    int n = self->max - self->nsocket;
+    if (n <= 0)
+        return 1;
+    if (n > SOCKET_CHUNK)
+        n = SOCKET_CHUNK;
     int i;
-    struct socket *s = malloc(max*sizeof(struct socket)); 
-    for (i=0; i<max; ++i) { 
-        s[i].fd = i+1;
+    struct socket *s = malloc(n*sizeof(struct socket)); 
+    for (i=0; i<n; ++i) { 
+        s[i].id = self->nsocket+i;
+        s[i].fd = -1;
         s[i].status = STATUS_INVALID;
         s[i].mask = 0;
         s[i].ud = -1;
         s[i].head = NULL;
         s[i].tail = NULL;
         s[i].sbuffersz = 0;
+        s[i].flush = 0;
+        s[i].flush_next = NULL;
+        s[i].edge = 0;
+        s[i].ready = 0;
+        s[i].ready_next = NULL;
+        s[i].whigh = 0;
+        s[i].wlow = 0;
+        s[i].blocked = 0;
+        s[i].notify = 0;
+        s[i].notify_next = NULL;
+        s[i].rhigh = 0;
+        s[i].rlow = 0;
+        s[i].rpending = 0;
+        s[i].rpaused = 0;
+        s[i].free_next = i+1 < n ? &s[i+1] : NULL;
     }
-    s[max-1].fd = -1;
-    return s;
+    self->chunks[self->nsocket/SOCKET_CHUNK] = s;
+    self->nsocket += n;
+    self->free_socket = &s[0];
+    self->tail_socket = &s[n-1];
+    return 0;
+}
+
+// the next generation of the slot
+static inline int
+_next_id(struct net *self, int id) {
+    int index_mask = (1<<self->index_bits)-1;
+    int gen_mask = (int)((1u<<(31-self->index_bits))-1);
+    int gen = ((id >> self->index_bits) + 1) & gen_mask;
+    return (gen << self->index_bits) | (id & index_mask);
 }
 
 static struct socket*
@@ -105,28 +294,195 @@ _create_socket(struct net *self, socket_t fd, int ud, int protocol) {
     if (protocol < SOCKET_PROTOCOL_TCP || protocol > SOCKET_PROTOCOL_IPC) {
         protocol = SOCKET_PROTOCOL_TCP;
     } 
-    if (self->free_socket == NULL)
+    if (self->free_socket == NULL &&
+        _alloc_sockets(self))
         return NULL;
     struct socket *s = self->free_socket;
-    if (s->fd >= 0)
-        self->free_socket = &self->sockets[s->fd];
-    else
-        self->free_socket = NULL;
+    self->free_socket = s->free_next;
+    s->free_next = NULL;
+    s->id = _next_id(self, s->id);
     s->fd = fd;
     s->protocol = protocol;
+    s->packet = 0;
+    s->udp6 = 0;
     s->status = STATUS_SUSPEND;
     s->mask = 0; 
+    s->edge = 0;
     s->ud = ud;
     s->head = NULL;
     s->tail = NULL;
     s->sbuffersz = 0;
     s->rbuffersz = RBUFFER_SZ;
+    s->whigh = 0;
+    s->wlow = 0;
+    s->blocked = 0;
+    s->rhigh = 0;
+    s->rlow = 0;
+    s->rpending = 0;
+    s->rpaused = 0;
+    s->rbytes = 0;
+    s->wbytes = 0;
+    s->rcount = 0;
+    s->wcount = 0;
+    s->ctime = self->now;
+    s->atime = self->now;
+    s->zerocopy = 0;
+    s->zused = 0;
+    s->zseq = 0;
+    s->zdone = 0;
+    s->zring = NULL;
+    s->zhead = NULL;
+    s->ztail = NULL;
+    s->zbytes = 0;
+    s->zcopied = 0;
+    s->mark = 0;
     return s;
 }
 
+// count is the read or write call, or the datagram for udp
+static inline void
+_stat_read(struct net *self, struct socket *s, int size, int count) {
+    s->rbytes += size;
+    s->rcount += count;
+    s->atime = self->now;
+}
+
+static inline void
+_stat_write(struct net *self, struct socket *s, int size, int count) {
+    s->wbytes += size;
+    s->wcount += count;
+    s->atime = self->now;
+}
+
+static inline int
+_zerocopy(struct socket *s, int sz) {
+    return s->zerocopy > 0 && sz >= s->zerocopy &&
+        s->zseq - s->zdone < ZEROCOPY_WINDOW;
+}
+
+// the buffer fully sent, keep it until the completion of the last
+// zerocopy send
+static void
+_zerocopy_wait(struct socket *s, void *data) {
+    struct zbuffer *z = malloc(sizeof(*z));
+    z->next = NULL;
+    z->seq = s->zseq - 1;
+    z->expire = 0;
+    z->data = data;
+    if (s->ztail)
+        s->ztail->next = z;
+    else
+        s->zhead = z;
+    s->ztail = z;
+}
+
+// read the completion from the error queue, every zerocopy send has a
+// sequence from 0, the range of them is completed by one notification,
+// free the buffer all its send completed
+static void
+_zerocopy_done(struct net *self, struct socket *s) {
+#ifdef SOCKET_ZEROCOPY
+    if (s->zring == NULL)
+        return;
+    char control[128];
+    struct msghdr msg;
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(s->fd, &msg, MSG_ERRQUEUE) == -1)
+            break; // EAGAIN
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+            struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            // the kernel copy it anyway (eg. loopback), no gain, stop it
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                s->zcopied++;
+                s->zerocopy = 0;
+            }
+            uint32_t i;
+            for (i = ee->ee_info; ; ++i) {
+                if (i - s->zdone < ZEROCOPY_WINDOW)
+                    s->zring[i % ZEROCOPY_WINDOW] = 1;
+                if (i == ee->ee_data)
+                    break;
+            }
+        }
+    }
+    while (s->zdone != s->zseq && s->zring[s->zdone % ZEROCOPY_WINDOW]) {
+        s->zring[s->zdone % ZEROCOPY_WINDOW] = 0;
+        s->zdone++;
+    }
+    while (s->zhead && (int32_t)(s->zhead->seq - s->zdone) < 0) {
+        struct zbuffer *z = s->zhead;
+        s->zhead = z->next;
+        free(z->data);
+        free(z);
+    }
+    if (s->zhead == NULL)
+        s->ztail = NULL;
+#endif
+}
+
+// the socket is closed with the zerocopy buffer wait the completion,
+// free it later, the kernel may send it yet
+static void
+_zerocopy_linger(struct net *self, uint64_t now) {
+    while (self->zlinger && self->zlinger->expire <= now) {
+        struct zbuffer *z = self->zlinger;
+        self->zlinger = z->next;
+        free(z->data);
+        free(z);
+    }
+    if (self->zlinger == NULL)
+        self->zlinger_tail = NULL;
+}
+
+// return like write, the buffer is kept by _zerocopy_wait if sent
+static int
+_send_zerocopy(struct net *self, struct socket *s, void *data, int sz) {
+#ifdef SOCKET_ZEROCOPY
+    int n = send(s->fd, data, sz, MSG_ZEROCOPY);
+    if (n > 0) {
+        s->zseq++;
+        s->zused = 1;
+        s->zbytes += n;
+        return n;
+    } else if (n < 0 && errno == ENOBUFS) {
+        // over the optmem limit, copy it this time
+        return _socket_write(s->fd, data, sz);
+    } else return n;
+#else
+    return _socket_write(s->fd, data, sz);
+#endif
+}
+
 static void
 _close_socket(struct net *self, struct socket *s) {
     if (s->fd < 0) return;
+    if (s->zused && s->head) {
+        _zerocopy_wait(s, s->head->begin);
+        s->head->begin = NULL;
+    }
+    if (s->zhead) {
+        _zerocopy_done(self, s);
+        struct zbuffer *z;
+        for (z = s->zhead; z; z = z->next)
+            z->expire = self->now + ZEROCOPY_LINGER;
+        if (s->zhead) {
+            if (self->zlinger_tail)
+                self->zlinger_tail->next = s->zhead;
+            else
+                self->zlinger = s->zhead;
+            self->zlinger_tail = s->ztail;
+        }
+        s->zhead = s->ztail = NULL;
+    }
 
     // don't do this, or in the issue, fork
     // child close listen socket, then will
@@ -135,32 +491,51 @@ _close_socket(struct net *self, struct socket *s) {
     // note: epoll_create fd will inherited by a child created with fork, 
     // but kqueue is not.
     //_subscribe(self, s, 0);
+#ifdef NP_COMPLETION
+    // but the inflight request hold the file, the socket is not closed,
+    // the canceling one even the mask is 0
+    np_del(&self->np, s->fd);
+#endif
 
     // eg bind stdin for async read data
     if (s->fd > STDERR_FILENO) {
         _socket_close(s->fd);
     }
+    if (self->udp->s == s) {
+        // drop the rest datagram
+        self->udp->s = NULL;
+        self->udp->count = 0;
+        self->udp->index = 0;
+    }
     s->fd = -1;
     s->status = STATUS_INVALID;
     s->ud = 0; 
     while (s->head) {
         struct sbuffer *p = s->head;
         s->head = s->head->next;
+        if (p->fd >= 0)
+            _socket_close(p->fd); // dup by socket_sendfd
         free(p->begin);
         free(p);
     }
     s->tail = NULL;
     s->sbuffersz = 0;
+    free(s->zring);
+    s->zring = NULL;
+    s->zerocopy = 0;
+    s->zused = 0;
+    // reuse the slot later, the generation wrap slow
     if (self->free_socket == NULL) {
         self->free_socket = s;
     } else {
         assert(self->tail_socket);
-        assert(self->tail_socket->fd == -1);
-        self->tail_socket->fd = sockid(s);
+        self->tail_socket->free_next = s;
     }
     self->tail_socket = s;
 }
 
+int _send_buffer_tcp(struct net *self, struct socket *s);
+
 int
 socket_close(struct net *self, int id, int force) {
     struct socket *s = _socket(self, id);
@@ -168,6 +543,10 @@ socket_close(struct net *self, int id, int force) {
     if (s->status == STATUS_INVALID)
         return 0;
     if (force || !s->head) {
+        // the deferred send is not tried yet, try it like the direct send
+        if (s->flush && s->head && s->protocol == SOCKET_PROTOCOL_TCP &&
+            !(s->mask & NP_WABLE))
+            _send_buffer_tcp(self, s);
         _close_socket(self, s);
         return 0;
     } else {
@@ -176,12 +555,15 @@ socket_close(struct net *self, int id, int force) {
     }
 }
 
+// the read paused by rhigh keep off, resume by socket_consumed
 int
 socket_enableread(struct net *self, int id, int read) {
     struct socket *s = _socket(self, id);
     if (s == NULL) return 1;
     int mask = 0;
-    if (read)
+    if (!read)
+        s->rpaused = 0;
+    else if (!s->rpaused)
         mask |= NP_RABLE;
     if (s->mask & NP_WABLE)
         mask |= NP_WABLE;
@@ -197,22 +579,134 @@ socket_udata(struct net *self, int id, int ud) {
     return 0;
 }
 
+static void
+_wakeup_close(struct net *self) {
+    _socket_close(self->wakeup.fd);
+    if (self->wakeup_fd != self->wakeup.fd)
+        _socket_close(self->wakeup_fd);
+    self->wakeup.fd = -1;
+    self->wakeup_fd = -1;
+}
+
+// the wakeup fd (eventfd or pipe) is not in sockets, so no socket id for it
+static int
+_wakeup_open(struct net *self) {
+    int fd[2];
+    if (np_wakeup_open(fd))
+        return 1;
+    struct socket *s = &self->wakeup;
+    memset(s, 0, sizeof(*s));
+    s->fd = fd[0];
+    s->status = STATUS_WAKEUP;
+    s->ud = -1;
+    self->wakeup_fd = fd[1];
+    self->wakeup_pending = 0;
+    if (_subscribe(self, s, NP_RABLE)) {
+        _wakeup_close(self);
+        return 1;
+    }
+    return 0;
+}
+
+static void
+_wakeup_drain(struct net *self) {
+    uint64_t tmp[8];
+    __sync_lock_release(&self->wakeup_pending);
+    while (_socket_read(self->wakeup.fd, tmp, sizeof(tmp)) > 0)
+        ;
+}
+
+// break the poll wait, can call from other thread or signal handler
+void
+socket_wakeup(struct net *self) {
+    if (__sync_bool_compare_and_swap(&self->wakeup_pending, 0, 1)) {
+        uint64_t c = 1;
+        int n = _socket_write(self->wakeup_fd, &c, sizeof(c));
+        (void)n;
+    }
+}
+
+// timerfd, open when first use, not in sockets as the wakeup
+static int
+_timer_open(struct net *self) {
+    int fd = np_timer_open();
+    if (fd == -1)
+        return 1;
+    struct socket *s = &self->timer;
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->status = STATUS_TIMER;
+    s->ud = -1;
+    if (_subscribe(self, s, NP_RABLE)) {
+        _socket_close(fd);
+        s->fd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+// break the poll at the absolute usec (CLOCK_MONOTONIC), 0 to disarm,
+// return 1 if no support
+int
+socket_settimer(struct net *self, uint64_t usec) {
+    if (self->timer.fd == -1 && _timer_open(self))
+        return 1;
+    return np_timer_set(self->timer.fd, usec) ? 1 : 0;
+}
+
 struct net*
 net_create(int max) {
     if (max <= 0)
         max = 1;
+    if (max > SOCKET_MAX)
+        max = SOCKET_MAX;
     struct net *self = malloc(sizeof(struct net));
-    if (np_init(&self->np, max)) {
+    self->batch = max < EVENT_BATCH ? max : EVENT_BATCH;
+    if (np_init(&self->np, self->batch)) {
+        free(self);
+        return NULL;
+    }
+    if (_wakeup_open(self)) {
+        np_fini(&self->np);
         free(self);
         return NULL;
     }
+    self->timer.fd = -1;
+    self->defer = 0;
+    self->defer_wakeup = 0;
+    self->flush_head = NULL;
+    self->edge = 0;
+    self->backlog = LISTEN_BACKLOG;
+    self->accept_batch = ACCEPT_BATCH;
+    self->accepted = 0;
+    self->ready_count = 0;
+    self->ready_head = NULL;
+    self->ready_tail = NULL;
+    self->notify_count = 0;
+    self->notify_head = NULL;
+    self->notify_tail = NULL;
+    // alloc once, not published later to the poll out of the lock
+    self->udp = malloc(sizeof(*self->udp));
+    self->udp->s = NULL;
+    self->udp->count = 0;
+    self->udp->index = 0;
+    self->packet = NULL;
+    self->zlinger = NULL;
+    self->zlinger_tail = NULL;
+    self->now = _socket_now();
+    self->top_time = self->now;
     self->max = max;
-    self->events = malloc(max*sizeof(struct np_event));
+    self->index_bits = 0;
+    while ((1<<self->index_bits) < max)
+        self->index_bits++;
+    self->events = malloc(self->batch*sizeof(struct np_event));
     self->event_count = 0;
     self->event_index = 0;
-    self->sockets = _alloc_sockets(max);
-    self->free_socket = &self->sockets[0];
-    self->tail_socket = &self->sockets[max-1];
+    self->chunks = calloc((max+SOCKET_CHUNK-1)/SOCKET_CHUNK, sizeof(struct socket *));
+    self->nsocket = 0;
+    self->free_socket = NULL;
+    self->tail_socket = NULL;
+    _alloc_sockets(self);
     return self;
 }
 
@@ -222,20 +716,97 @@ net_free(struct net *self) {
         return;
 
     int i;
-    for (i=0; i<self->max; ++i) {
-        struct socket *s = &self->sockets[i];
+    for (i=0; i<self->nsocket; ++i) {
+        struct socket *s = _slot(self, i);
         if (s->status >= STATUS_OPENED) {
             _close_socket(self, s);
         }
     }
-    free(self->sockets);
+    for (i=0; i<self->nsocket; i+=SOCKET_CHUNK)
+        free(self->chunks[i/SOCKET_CHUNK]);
+    free(self->chunks);
     self->free_socket = NULL;
     self->tail_socket = NULL;
     free(self->events);
+    free(self->udp);
+    free(self->packet);
+    _zerocopy_linger(self, UINT64_MAX);
+    _wakeup_close(self);
+    if (self->timer.fd != -1)
+        _socket_close(self->timer.fd);
     np_fini(&self->np);
     free(self);
 }
 
+// the edge socket may have more data, read it again before the next np poll,
+// let the other socket read first
+static void
+_read_again(struct net *self, struct socket *s) {
+    if (!s->edge || s->ready)
+        return;
+    s->ready = 1;
+    s->ready_next = NULL;
+    if (self->ready_tail)
+        self->ready_tail->ready_next = s;
+    else
+        self->ready_head = s;
+    self->ready_tail = s;
+    self->ready_count++;
+}
+
+// the send buffer grow up to the high watermark, report BLOCKED in the
+// next poll, return the send buffer size
+static int
+_check_blocked(struct net *self, struct socket *s) {
+    if (s->whigh <= 0 || s->blocked || s->sbuffersz < s->whigh)
+        return s->sbuffersz;
+    s->blocked = 1;
+    if (!s->notify) {
+        if (self->notify_head == NULL && self->defer_wakeup)
+            socket_wakeup(self);
+        s->notify = 1;
+        s->notify_next = NULL;
+        if (self->notify_tail)
+            self->notify_tail->notify_next = s;
+        else
+            self->notify_head = s;
+        self->notify_tail = s;
+        self->notify_count++;
+    }
+    return s->sbuffersz;
+}
+
+// BLOCKED when the send buffer grow up to high, then WRITABLE when it
+// drop to low, high 0 to disable
+int
+socket_watermark(struct net *self, int id, int high, int low) {
+    struct socket *s = _socket(self, id);
+    if (s == NULL || s->status == STATUS_INVALID)
+        return -1;
+    if (high < 0)
+        high = 0;
+    if (low > high)
+        low = high;
+    if (low < 0)
+        low = 0;
+    s->whigh = high;
+    s->wlow = low;
+    if (high == 0)
+        s->blocked = 0;
+    return 0;
+}
+
+// the edge socket is chosen before np_poll
+int
+socket_edge(struct net *self, int edge) {
+#ifdef NP_EDGE_TRIGGER
+    self->edge = edge;
+    return 0;
+#else
+    return edge ? 1 : 0;
+#endif
+}
+
 static int
 _read_close(struct socket *s) {
     char buf[1024];
@@ -248,45 +819,106 @@ _read_close(struct socket *s) {
             else return -1;
         } else if (n == 0) {
             return -1;
-        } else return 0; // we not care data
+        } // we not care data, drain it
+    }
+}
+
+#ifdef NP_COMPLETION
+// the data is read by np, copy it out
+static int
+_read_done(struct net *self, struct socket *s, struct np_event *event, void **data) {
+    int n = event->size;
+    if (n <= 0) {
+        // zero indicates end of file
+        _close_socket(self, s);
+        return -1;
+    }
+    if (s->status == STATUS_HALFCLOSE)
+        return 0; // we not care data
+    void *p = socket_rbuf_alloc(n);
+    memcpy(p, event->data, n);
+    *data = p;
+    return n;
+}
+#endif
+
+// one message for one read, keep the boundary
+static int
+_read_packet(struct net *self, struct socket *s, void **data) {
+    if (self->packet == NULL) {
+        self->packet = malloc(PACKET_MAXSIZE);
+    }
+    struct iovec iov;
+    iov.iov_base = self->packet;
+    iov.iov_len = PACKET_MAXSIZE;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    for (;;) {
+        int n = recvmsg(s->fd, &msg, 0);
+        if (n < 0) {
+            int err = _socket_geterror(s->fd);
+            if (err == SEAGAIN)
+                return 0;
+            else if (err == SEINTR)
+                continue;
+        } else if (n > 0 && !(msg.msg_flags & MSG_TRUNC)) {
+            _read_again(self, s);
+            void *p = socket_rbuf_alloc(n);
+            memcpy(p, self->packet, n);
+            *data = p;
+            return n;
+        }
+        // end of file, or the message is truncated
+        _close_socket(self, s);
+        return -1;
     }
 }
 
 // return read size, or -1 for error
 static int
-_read_tcp(struct net *self, struct socket *s, void **data) {
+_read_tcp(struct net *self, struct socket *s, struct np_event *event, void **data) {
+#ifdef NP_COMPLETION
+    if (event->done)
+        return _read_done(self, s, event, data);
+#endif
     if (s->status == STATUS_HALFCLOSE) {
         if (_read_close(s)) {
             _close_socket(self, s);
             return -1;
         } else return 0;
     }
+    if (s->packet)
+        return _read_packet(self, s, data);
     int size = s->rbuffersz;
-    void *p = malloc(size);
+    void *p = socket_rbuf_alloc(size);
     for (;;) {
         int n = _socket_read(s->fd, p, size);
         if (n < 0) {
             int err = _socket_geterror(s->fd);
             switch (err) {
             case SEAGAIN:
-                free(p);
+                socket_rbuf_free(p);
                 return 0;
             case SEINTR:
                 continue;
             default:
-                free(p);
+                socket_rbuf_free(p);
                 _close_socket(self, s);
                 return -1;
             }
         } else if (n == 0) {
             // zero indicates end of file
-            free(p);
+            socket_rbuf_free(p);
             _close_socket(self, s);
             return -1;
         } else {
+            if (n == size)
+                _read_again(self, s);
             if (n == s->rbuffersz)
                 s->rbuffersz <<= 1;
-            else if (s->rbuffersz > RBUFFER_SZ && n < (s->rbuffersz<<1))
+            else if (s->rbuffersz > RBUFFER_SZ && n*2 < s->rbuffersz)
                 s->rbuffersz >>= 1;
             *data = p;
             return n;
@@ -377,6 +1009,8 @@ _read_fd(struct net *self, struct socket *s, void **data) {
             _close_socket(self, s);
             return -1;
         }
+        // one message a read, maybe more
+        _read_again(self, s);
         if (cmsg.cm.cmsg_len == CMSG_LEN(sizeof(int))) {
             if (cmsg.cm.cmsg_level != SOL_SOCKET || cmsg.cm.cmsg_type != SCM_RIGHTS) {
                 fprintf(stderr, "Socket error: read fd msg type dismatch\n");
@@ -397,23 +1031,275 @@ _read_fd(struct net *self, struct socket *s, void **data) {
     }
 }
 
+// the v4 mapped address of the dual stack socket is packed as v4
+static int
+_udpaddr_pack(const union sockaddr_all *sa, uint8_t *udpaddr) {
+    if (sa->s.sa_family == AF_INET6 &&
+        IN6_IS_ADDR_V4MAPPED(&sa->v6.sin6_addr)) {
+        udpaddr[0] = UDPADDR_V4;
+        memcpy(udpaddr+1, &sa->v6.sin6_port, 2);
+        memcpy(udpaddr+3, (const uint8_t*)&sa->v6.sin6_addr + 12, 4);
+        return 7;
+    } else if (sa->s.sa_family == AF_INET) {
+        udpaddr[0] = UDPADDR_V4;
+        memcpy(udpaddr+1, &sa->v4.sin_port, 2);
+        memcpy(udpaddr+3, &sa->v4.sin_addr, 4);
+        return 7;
+    } else if (sa->s.sa_family == AF_INET6) {
+        udpaddr[0] = UDPADDR_V6;
+        memcpy(udpaddr+1, &sa->v6.sin6_port, 2);
+        memcpy(udpaddr+3, &sa->v6.sin6_addr, 16);
+        return 19;
+    } else {
+        udpaddr[0] = 0;
+        return 0;
+    }
+}
+
+// return the sockaddr size, 0 for no address, v6 for the AF_INET6 socket,
+// then the v4 address is v4 mapped
+static socklen_t
+_udpaddr_unpack(const uint8_t *udpaddr, union sockaddr_all *sa, int v6) {
+    memset(sa, 0, sizeof(*sa));
+    switch (udpaddr[0]) {
+    case UDPADDR_V4:
+        if (v6) {
+            uint8_t *a = (uint8_t*)&sa->v6.sin6_addr;
+            sa->v6.sin6_family = AF_INET6;
+            memcpy(&sa->v6.sin6_port, udpaddr+1, 2);
+            a[10] = a[11] = 0xff;
+            memcpy(a+12, udpaddr+3, 4);
+            return sizeof(sa->v6);
+        }
+        sa->v4.sin_family = AF_INET;
+        memcpy(&sa->v4.sin_port, udpaddr+1, 2);
+        memcpy(&sa->v4.sin_addr, udpaddr+3, 4);
+        return sizeof(sa->v4);
+    case UDPADDR_V6:
+        sa->v6.sin6_family = AF_INET6;
+        memcpy(&sa->v6.sin6_port, udpaddr+1, 2);
+        memcpy(&sa->v6.sin6_addr, udpaddr+3, 16);
+        return sizeof(sa->v6);
+    default:
+        return 0;
+    }
+}
+
+// the udp address size, 0 for invalid
+int
+socket_udpaddrsz(const uint8_t *udpaddr) {
+    switch (udpaddr[0]) {
+    case UDPADDR_V4: return 7;
+    case UDPADDR_V6: return 19;
+    default: return 0;
+    }
+}
+
+// the ip string and port of the udp address, return 0 for ok
+int
+socket_udpaddr(const uint8_t *udpaddr, char *ip, int sz, int *port) {
+    union sockaddr_all sa;
+    if (_udpaddr_unpack(udpaddr, &sa, 0) == 0)
+        return 1;
+    if (sa.s.sa_family == AF_INET) {
+        if (inet_ntop(AF_INET, &sa.v4.sin_addr, ip, sz) == NULL)
+            return 1;
+        *port = ntohs(sa.v4.sin_port);
+    } else {
+        if (inet_ntop(AF_INET6, &sa.v6.sin6_addr, ip, sz) == NULL)
+            return 1;
+        *port = ntohs(sa.v6.sin6_port);
+    }
+    return 0;
+}
+
+// return the datagram count, 0 for none or error
+static int
+_udp_recv(socket_t fd, struct udp_recv *u) {
+    int n;
+#ifdef __linux__
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    int i;
+    memset(msgs, 0, sizeof(msgs));
+    for (i=0; i<UDP_BATCH; ++i) {
+        iov[i].iov_base = u->buffer[i];
+        iov[i].iov_len = UDP_RECV_MAXSIZE;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &u->addr[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(u->addr[i]);
+    }
+    for (;;) {
+        n = recvmmsg(fd, msgs, UDP_BATCH, 0, NULL);
+        if (n < 0) {
+            // EAGAIN, or the icmp error for the connected udp, it is cleared
+            if (_socket_geterror(fd) == SEINTR)
+                continue;
+            return 0;
+        }
+        break;
+    }
+    for (i=0; i<n; ++i) {
+        u->size[i] = msgs[i].msg_len;
+        u->flags[i] = msgs[i].msg_hdr.msg_flags;
+    }
+#else
+    for (;;) {
+        socklen_t l = sizeof(u->addr[0]);
+        n = recvfrom(fd, u->buffer[0], UDP_RECV_MAXSIZE, 0, &u->addr[0].s, &l);
+        if (n < 0) {
+            if (_socket_geterror(fd) == SEINTR)
+                continue;
+            return 0;
+        }
+        u->size[0] = n;
+        u->flags[0] = 0;
+        n = 1;
+        break;
+    }
+#endif
+    u->count = n;
+    u->index = 0;
+    return n;
+}
+
+// the next datagram of the batch
+static int
+_udp_next(struct net *self, struct socket_message *msg) {
+    struct udp_recv *u = self->udp;
+    while (u->index < u->count) {
+        int i = u->index++;
+        if (u->flags[i] & MSG_TRUNC) {
+            fprintf(stderr, "Socket error: udp datagram is truncated\n");
+            continue;
+        }
+        struct socket *s = u->s;
+        int sz = u->size[i];
+        _stat_read(self, s, sz, 1);
+        msg->id = sockid(s);
+        msg->ud = s->ud;
+        msg->type = SOCKET_TYPE_UDP;
+        if (sz > 0) {
+            msg->data = socket_rbuf_alloc(sz);
+            memcpy(msg->data, u->buffer[i], sz);
+        } else {
+            msg->data = NULL;
+        }
+        msg->size = sz;
+        _udpaddr_pack(&u->addr[i], msg->udpaddr);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+_read_udp(struct net *self, struct socket *s, struct socket_message *msg) {
+    struct udp_recv *u = self->udp;
+    u->s = s;
+    if (_udp_recv(s->fd, u) == UDP_BATCH)
+        _read_again(self, s);
+    return _udp_next(self, msg);
+}
+
+// pause the read when the unconsumed data grow up to rhigh, the kernel
+// buffer fill up then the tcp flow control throttle the peer
+static inline void
+_read_pending(struct net *self, struct socket *s, int size) {
+    if (s->rhigh <= 0)
+        return;
+    s->rpending += size;
+    if (!s->rpaused && s->rpending >= s->rhigh && (s->mask & NP_RABLE)) {
+        if (_subscribe(self, s, s->mask & NP_WABLE) == 0)
+            s->rpaused = 1;
+    }
+}
+
+// pause the read when the data read but not consumed grow up to high,
+// resume when it drop to low by socket_consumed, high 0 to disable
+int
+socket_readlimit(struct net *self, int id, int high, int low) {
+    struct socket *s = _socket(self, id);
+    if (s == NULL || s->status == STATUS_INVALID)
+        return -1;
+    if (high < 0)
+        high = 0;
+    if (low > high)
+        low = high;
+    if (low < 0)
+        low = 0;
+    s->rhigh = high;
+    s->rlow = low;
+    s->rpending = 0;
+    if (high == 0 && s->rpaused) {
+        s->rpaused = 0;
+        return _subscribe(self, s, NP_RABLE|(s->mask & NP_WABLE));
+    }
+    return 0;
+}
+
+// send the buffer not less than threshold by MSG_ZEROCOPY, the kernel
+// send it from the buffer, no copy, 0 to disable, it is stopped if the
+// kernel copy it anyway, return -1 if no support
+int
+socket_zerocopy(struct net *self, int id, int threshold) {
+    struct socket *s = _socket(self, id);
+    if (s == NULL || s->status == STATUS_INVALID ||
+        s->protocol != SOCKET_PROTOCOL_TCP || s->packet)
+        return -1;
+#ifdef SOCKET_ZEROCOPY
+    if (threshold > 0 && s->zring == NULL) {
+        int on = 1;
+        if (setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)))
+            return -1;
+        s->zring = calloc(ZEROCOPY_WINDOW, 1);
+    }
+    s->zerocopy = threshold > 0 ? threshold : 0;
+    return 0;
+#else
+    return threshold > 0 ? -1 : 0;
+#endif
+}
+
+// the reader consume size of the data, resume the read paused
+int
+socket_consumed(struct net *self, int id, int size) {
+    struct socket *s = _socket(self, id);
+    if (s == NULL || s->status == STATUS_INVALID || s->rhigh <= 0)
+        return -1;
+    s->rpending -= size;
+    if (s->rpending < 0)
+        s->rpending = 0;
+    if (s->rpaused && s->rpending <= s->rlow) {
+        s->rpaused = 0;
+        return _subscribe(self, s, NP_RABLE|(s->mask & NP_WABLE));
+    }
+    return 0;
+}
+
 static int
-_read(struct net *self, struct socket *s, struct socket_message *msg) {
+_read(struct net *self, struct socket *s, struct np_event *event, struct socket_message *msg) {
     void *data;
     int size;
     msg->id = sockid(s);
     msg->ud = s->ud;
+    if (s->zhead)
+        _zerocopy_done(self, s);
     switch (s->protocol) {
     case SOCKET_PROTOCOL_TCP: 
-        size = _read_tcp(self, s, &data); 
+        size = _read_tcp(self, s, event, &data); 
         break;
     case SOCKET_PROTOCOL_IPC: 
         size = _read_fd(self, s, &data); 
         break;
+    case SOCKET_PROTOCOL_UDP:
+        return _read_udp(self, s, msg);
     default: 
         assert(false); 
     }
     if (size > 0) {
+        _read_pending(self, s, size);
+        _stat_read(self, s, size, 1);
         msg->type = SOCKET_TYPE_DATA; 
         msg->data = data;
         msg->size = size;
@@ -424,12 +1310,39 @@ _read(struct net *self, struct socket *s, struct socket_message *msg) {
     } else return 0;
 }
 
+// one buffer for one write, the seqpacket message is never merged
+static int
+_send_buffer_packet(struct net *self, struct socket *s) {
+    while (s->head) {
+        struct sbuffer *b = s->head;
+        int n = _socket_write(s->fd, b->ptr, b->sz);
+        if (n < 0) {
+            int err = _socket_geterror(s->fd);
+            switch (err) {
+            case SEAGAIN: return 0;
+            case SEINTR: continue;
+            default: return err;
+            }
+        }
+        _stat_write(self, s, n, 1);
+        s->sbuffersz -= b->sz;
+        s->head = b->next;
+        free(b->begin);
+        free(b);
+    }
+    return 0;
+}
+
+// gather at most IOV_MAX buffers to one writev
 int
 _send_buffer_tcp(struct net *self, struct socket *s) {
+    if (s->packet)
+        return _send_buffer_packet(self, s);
+    struct iovec iov[IOV_MAX];
     while (s->head) {
         struct sbuffer *b = s->head;
-        for (;;) {
-            int n = _socket_write(s->fd, b->ptr, b->sz);
+        if (_zerocopy(s, b->sz)) {
+            int n = _send_zerocopy(self, s, b->ptr, b->sz);
             if (n < 0) {
                 int err = _socket_geterror(s->fd);
                 switch (err) {
@@ -437,19 +1350,63 @@ _send_buffer_tcp(struct net *self, struct socket *s) {
                 case SEINTR: continue;
                 default: return err;
                 }
-            } else if (n < b->sz) {
+            }
+            _stat_write(self, s, n, 1);
+            s->sbuffersz -= n;
+            if (n < b->sz) {
                 b->ptr += n;
                 b->sz -= n;
-                s->sbuffersz -= n;
-                return 0;
-            } else {
-                s->sbuffersz -= n;
+                return 0; // kernel buffer is full
+            }
+            s->head = b->next;
+            _zerocopy_wait(s, b->begin);
+            s->zused = 0;
+            free(b);
+            continue;
+        }
+        int cnt = 0;
+        int total = 0;
+        // the zerocopy one is sent alone
+        while (b && cnt < IOV_MAX && !(cnt > 0 && _zerocopy(s, b->sz))) {
+            iov[cnt].iov_base = b->ptr;
+            iov[cnt].iov_len = b->sz;
+            total += b->sz;
+            cnt++;
+            b = b->next;
+        }
+        int n;
+        for (;;) {
+            n = _socket_writev(s->fd, iov, cnt);
+            if (n < 0) {
+                int err = _socket_geterror(s->fd);
+                switch (err) {
+                case SEAGAIN: return 0;
+                case SEINTR: continue;
+                default: return err;
+                }
+            } else break;
+        }
+        _stat_write(self, s, n, 1);
+        s->sbuffersz -= n;
+        int left = n;
+        while (left > 0) {
+            b = s->head;
+            if (left < b->sz) {
+                b->ptr += left;
+                b->sz -= left;
                 break;
             }
-        } 
-        s->head = b->next;
-        free(b->begin);
-        free(b);
+            left -= b->sz;
+            s->head = b->next;
+            if (s->zused) {
+                _zerocopy_wait(s, b->begin);
+                s->zused = 0;
+            } else
+                free(b->begin);
+            free(b);
+        }
+        if (n < total)
+            return 0; // kernel buffer is full
     }
     return 0;
 }
@@ -469,8 +1426,13 @@ _send_buffer_ipc(struct net *self, struct socket *s) {
                 }
             } else if (n==0) {
                 return 0;
-            } else if (n<b->sz) {
-                b->fd   = -1; // the fd should be send
+            }
+            _stat_write(self, s, n, 1);
+            if (n<b->sz) {
+                if (b->fd >= 0) {
+                    _socket_close(b->fd); // the fd should be send
+                    b->fd = -1;
+                }
                 b->ptr += n;
                 b->sz  -= n;
                 s->sbuffersz -= n;
@@ -481,15 +1443,77 @@ _send_buffer_ipc(struct net *self, struct socket *s) {
             }
         }
         s->head = b->next;
+        if (b->fd >= 0)
+            _socket_close(b->fd);
         free(b->begin);
         free(b);
     }
     return 0;
 }
 
+// sendmmsg a batch, the datagram failed for the error other than EAGAIN
+// is dropped, the socket keep open
+static int
+_send_buffer_udp(struct net *self, struct socket *s) {
+#ifdef __linux__
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    union sockaddr_all sa[UDP_BATCH];
+#else
+    union sockaddr_all sa[1];
+#endif
+    struct sbuffer *b;
+    while (s->head) {
+        int n;
+#ifdef __linux__
+        int cnt = 0;
+        b = s->head;
+        while (b && cnt < UDP_BATCH) {
+            struct msghdr *h = &msgs[cnt].msg_hdr;
+            memset(h, 0, sizeof(*h));
+            iov[cnt].iov_base = b->ptr;
+            iov[cnt].iov_len = b->sz;
+            h->msg_iov = &iov[cnt];
+            h->msg_iovlen = 1;
+            h->msg_namelen = _udpaddr_unpack(b->udpaddr, &sa[cnt], s->udp6);
+            h->msg_name = h->msg_namelen ? &sa[cnt] : NULL;
+            cnt++;
+            b = b->next;
+        }
+        n = sendmmsg(s->fd, msgs, cnt, 0);
+#else
+        b = s->head;
+        socklen_t l = _udpaddr_unpack(b->udpaddr, &sa[0], s->udp6);
+        n = sendto(s->fd, b->ptr, b->sz, 0, l ? &sa[0].s : NULL, l) < 0 ? -1 : 1;
+#endif
+        if (n < 0) {
+            int err = _socket_geterror(s->fd);
+            if (err == SEAGAIN)
+                return 0;
+            if (err == SEINTR)
+                continue;
+            n = 1; // drop it
+        } else {
+            int i;
+            for (i=0, b=s->head; i<n; ++i, b=b->next)
+                _stat_write(self, s, b->sz, 1);
+        }
+        while (n-- > 0) {
+            b = s->head;
+            s->head = b->next;
+            s->sbuffersz -= b->sz;
+            free(b->begin);
+            free(b);
+        }
+    }
+    return 0;
+}
+
 static int
 _send_buffer(struct net *self, struct socket *s, struct socket_message *msg) {
     int err;
+    if (s->zhead || s->zused)
+        _zerocopy_done(self, s); // the error queue is reported as write
     if (s->head == NULL) return 0;
     switch (s->protocol) {
     case SOCKET_PROTOCOL_TCP:
@@ -498,6 +1522,9 @@ _send_buffer(struct net *self, struct socket *s, struct socket_message *msg) {
     case SOCKET_PROTOCOL_IPC:
         err = _send_buffer_ipc(self, s);
         break;
+    case SOCKET_PROTOCOL_UDP:
+        err = _send_buffer_udp(self, s);
+        break;
     default:
         assert(false);
     }
@@ -512,6 +1539,13 @@ _send_buffer(struct net *self, struct socket *s, struct socket_message *msg) {
                 return 1;
             }
         }
+        if (s->blocked && s->sbuffersz <= s->wlow) {
+            s->blocked = 0;
+            msg->id = sockid(s);
+            msg->ud = s->ud;
+            msg->type = SOCKET_TYPE_WRITABLE;
+            return 1;
+        }
     } else {
         msg->id = sockid(s);
         msg->ud = s->ud;
@@ -522,6 +1556,67 @@ _send_buffer(struct net *self, struct socket *s, struct socket_message *msg) {
     return 0;
 }
 
+static struct sbuffer *
+_append_buffer(struct socket *s, void *data, int sz, int extra) {
+    struct sbuffer* p = malloc(sizeof(*p) + extra);
+    p->next = NULL;
+    p->sz = sz;
+    p->fd = -1;
+    p->begin = data;
+    p->ptr = data;
+    if (s->head == NULL) {
+        s->head = s->tail = p;
+    } else {
+        assert(s->tail != NULL);
+        assert(s->tail->next == NULL);
+        s->tail->next = p;
+        s->tail = p;
+    }
+    s->sbuffersz += sz;
+    return p;
+}
+
+// write in the next socket_flush
+static void
+_flush_later(struct net *self, struct socket *s) {
+    if (!s->flush) {
+        if (self->flush_head == NULL && self->defer_wakeup)
+            socket_wakeup(self);
+        s->flush = 1;
+        s->flush_next = self->flush_head;
+        self->flush_head = s;
+    }
+}
+
+void
+socket_defer(struct net *self, int defer, int wakeup) {
+    self->defer = defer;
+    self->defer_wakeup = wakeup;
+}
+
+// write the send queued after the last flush, one writev per socket,
+// return 1 with msg for the socket error, write done close or writable,
+// call until 0
+int
+socket_flush(struct net *self, struct socket_message *msg) {
+    while (self->flush_head) {
+        struct socket *s = self->flush_head;
+        self->flush_head = s->flush_next;
+        s->flush_next = NULL;
+        s->flush = 0;
+        // closed, or the poll will write it when writable
+        if (s->status == STATUS_INVALID || s->head == NULL ||
+            (s->mask & NP_WABLE))
+            continue;
+        int ret = _send_buffer(self, s, msg);
+        if (s->head)
+            _subscribe(self, s, s->mask|NP_WABLE);
+        if (ret)
+            return 1;
+    }
+    return 0;
+}
+
 // return send buffer size, or -1 for error
 int 
 socket_send(struct net* self, int id, void* data, int sz) {
@@ -531,17 +1626,35 @@ socket_send(struct net* self, int id, void* data, int sz) {
         free(data);
         return -1;
     }
+    if (s->protocol == SOCKET_PROTOCOL_UDP)
+        return socket_udpsend(self, id, NULL, data, sz);
     if (s->protocol != SOCKET_PROTOCOL_TCP || s->status == STATUS_HALFCLOSE) {
         fprintf(stderr, "Socket error: use send with invalid protocol %d\n", s->protocol);
         free(data);
         return -1; 
     }
     int err;
+    if (self->defer) {
+        _append_buffer(s, data, sz, 0);
+        _flush_later(self, s);
+        return _check_blocked(self, s);
+    }
     if (s->head == NULL) {
         char *ptr;
-        int n = _socket_write(s->fd, data, sz);
+        int n;
+        if (_zerocopy(s, sz)) {
+            _zerocopy_done(self, s);
+            n = _send_zerocopy(self, s, data, sz);
+        } else
+            n = _socket_write(s->fd, data, sz);
+        if (n > 0)
+            _stat_write(self, s, n, 1);
         if (n >= sz) {
-            free(data);
+            if (s->zused) {
+                _zerocopy_wait(s, data);
+                s->zused = 0;
+            } else
+                free(data);
             return 0;
         } else if (n >= 0) {
             ptr = (char*)data + n;
@@ -579,14 +1692,15 @@ socket_send(struct net* self, int id, void* data, int sz) {
         s->tail->next = p;
         s->tail = p;
     }
-    return s->sbuffersz;
+    return _check_blocked(self, s);
 errout:
     free(data);
     _close_socket(self, s);
     return -1;
 }
 
-// return send buffer size, -1 for error
+// return send buffer size, -1 for error, the queued cfd is dup,
+// so the caller can close cfd once return
 int
 socket_sendfd(struct net *self, int id, void *data, int sz, int cfd) {
     assert(sz > 0 || (data == NULL && sz == 1)); // if data == NULL, then sz set 1
@@ -603,6 +1717,8 @@ socket_sendfd(struct net *self, int id, void *data, int sz, int cfd) {
     if (s->head == NULL) {
         char *ptr;
         int n = _send_fd(s->fd, data, sz, cfd);
+        if (n > 0)
+            _stat_write(self, s, n, 1);
         if (n >= sz) {
             free(data);
             return 0;
@@ -626,7 +1742,7 @@ socket_sendfd(struct net *self, int id, void *data, int sz, int cfd) {
         struct sbuffer* p = malloc(sizeof(*p));
         p->next = NULL;
         p->sz = sz;
-        p->fd = cfd;
+        p->fd = cfd >= 0 ? dup(cfd) : -1;
         p->begin = data;
         p->ptr = ptr;
         
@@ -637,7 +1753,7 @@ socket_sendfd(struct net *self, int id, void *data, int sz, int cfd) {
         struct sbuffer* p = malloc(sizeof(*p));
         p->next = NULL;
         p->sz = sz;
-        p->fd = cfd;
+        p->fd = cfd >= 0 ? dup(cfd) : -1;
         p->begin = data;
         p->ptr = data;
         
@@ -646,13 +1762,165 @@ socket_sendfd(struct net *self, int id, void *data, int sz, int cfd) {
         s->tail->next = p;
         s->tail = p;
     }
-    return s->sbuffersz;
+    return _check_blocked(self, s);
 errout:
     free(data);
     _close_socket(self, s);
     return -1;
 }
 
+// udpaddr NULL for the connected udp, return send buffer size, or -1 for
+// error, the datagram failed to send is dropped as udp
+int
+socket_udpsend(struct net *self, int id, const uint8_t *udpaddr, void *data, int sz) {
+    struct socket *s = _socket(self, id);
+    if (s == NULL) {
+        free(data);
+        return -1;
+    }
+    if (s->protocol != SOCKET_PROTOCOL_UDP || s->status == STATUS_HALFCLOSE ||
+        (udpaddr && socket_udpaddrsz(udpaddr) == 0)) {
+        fprintf(stderr, "Socket error: use udp send with protocol %d\n", s->protocol);
+        free(data);
+        return -1;
+    }
+    if (udpaddr && udpaddr[0] == UDPADDR_V6 && !s->udp6) {
+        fprintf(stderr, "Socket error: udp send to ipv6 by the ipv4 socket %d\n", id);
+        free(data);
+        return -1;
+    }
+    if (!self->defer && s->head == NULL) {
+        union sockaddr_all sa;
+        socklen_t l = udpaddr ? _udpaddr_unpack(udpaddr, &sa, s->udp6) : 0;
+        int n;
+        for (;;) {
+            n = sendto(s->fd, data, sz, 0, l ? &sa.s : NULL, l);
+            if (n < 0 && _socket_geterror(s->fd) == SEINTR)
+                continue;
+            break;
+        }
+        if (n >= 0)
+            _stat_write(self, s, n, 1);
+        if (n >= 0 || _socket_geterror(s->fd) != SEAGAIN) {
+            free(data);
+            return 0;
+        }
+    }
+    struct sbuffer *p = _append_buffer(s, data, sz, SOCKET_UDP_ADDRSZ);
+    if (udpaddr)
+        memcpy(p->udpaddr, udpaddr, socket_udpaddrsz(udpaddr));
+    else
+        p->udpaddr[0] = 0;
+    if (self->defer)
+        _flush_later(self, s);
+    else
+        _subscribe(self, s, s->mask|NP_WABLE);
+    return _check_blocked(self, s);
+}
+
+// bind the addr if not NULL, or the kernel bind it in the first send
+int
+socket_udp(struct net *self, const char *addr, int port, int ud) {
+    int fd = -1, udp6 = 0;
+    if (addr && addr[0]) {
+        struct addrinfo hints;
+        struct addrinfo *result, *rp;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_protocol = IPPROTO_UDP;
+        hints.ai_flags = AI_PASSIVE;
+
+        char sport[16];
+        snprintf(sport, sizeof(sport), "%u", port);
+        if (getaddrinfo(addr, sport, &hints, &result)) {
+            return -1;
+        }
+        for (rp = result; rp; rp = rp->ai_next) {
+            fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+            if (fd == -1)
+                continue;
+            if (bind(fd, rp->ai_addr, rp->ai_addrlen) == -1) {
+                _socket_close(fd);
+                fd = -1;
+                continue;
+            }
+            udp6 = rp->ai_family == AF_INET6;
+            break;
+        }
+        freeaddrinfo(result);
+    } else {
+        // dual stack, send to the v4 and v6 both,
+        // or v4 only if the host has no ipv6
+        fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd != -1 && _socket_v6only(fd, 0) == -1) {
+            _socket_close(fd);
+            fd = -1;
+        }
+        if (fd != -1)
+            udp6 = 1;
+        else
+            fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    }
+    if (fd == -1)
+        return -1;
+    if (_socket_nonblocking(fd) == -1 ||
+        _socket_closeonexec(fd) == -1) {
+        _socket_close(fd);
+        return -1;
+    }
+    struct socket *s = _create_socket(self, fd, ud, SOCKET_PROTOCOL_UDP);
+    if (s == NULL) {
+        _socket_close(fd);
+        return -1;
+    }
+    s->udp6 = udp6;
+    s->status = STATUS_CONNECTED;
+    return sockid(s);
+}
+
+// set the default dest, and only recv from it
+int
+socket_udpconnect(struct net *self, int id, const char *addr, int port) {
+    struct socket *s = _socket(self, id);
+    if (s == NULL || s->protocol != SOCKET_PROTOCOL_UDP)
+        return -1;
+    struct addrinfo hints;
+    struct addrinfo *result, *rp;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+
+    char sport[16];
+    snprintf(sport, sizeof(sport), "%u", port);
+    if (getaddrinfo(addr, sport, &hints, &result)) {
+        return -1;
+    }
+    int err = -1;
+    for (rp = result; rp; rp = rp->ai_next) {
+        // by the udp address, the v4 one is mapped for the v6 socket
+        uint8_t udpaddr[SOCKET_UDP_ADDRSZ];
+        union sockaddr_all sa;
+        if (rp->ai_addrlen > sizeof(sa) ||
+            (rp->ai_family == AF_INET6 && !s->udp6))
+            continue;
+        memcpy(&sa, rp->ai_addr, rp->ai_addrlen);
+        if (_udpaddr_pack(&sa, udpaddr) == 0)
+            continue;
+        socklen_t l = _udpaddr_unpack(udpaddr, &sa, s->udp6);
+        if (connect(s->fd, &sa.s, l) == 0) {
+            err = 0;
+            break;
+        }
+    }
+    freeaddrinfo(result);
+    if (err)
+        fprintf(stderr, "Socket error: udp connect %s:%d failed%s\n", addr, port,
+                s->udp6 ? "" : " (the ipv4 socket)");
+    return err;
+}
+
 int
 socket_bind(struct net *self, int fd, int ud, int protocol) {
     struct socket *s;
@@ -669,24 +1937,30 @@ socket_bind(struct net *self, int fd, int ud, int protocol) {
 }
 
 static int
-_accept(struct net *self, struct socket *lis, struct socket_message *msg) {
+_accept(struct net *self, struct socket *lis, struct np_event *event, struct socket_message *msg) {
     struct sockaddr_storage sa;
     socklen_t l = sizeof(sa);
-    socket_t fd = accept(lis->fd, (struct sockaddr*)&sa, &l);
+#ifdef NP_COMPLETION
+    // accepted by np with nonblocking
+    socket_t fd = event->size;
+    if (getpeername(fd, (struct sockaddr*)&sa, &l)) {
+        _socket_close(fd);
+        return 0;
+    }
+#else
+    socket_t fd = _socket_accept(lis->fd, (struct sockaddr*)&sa, &l);
     if (fd < 0) {
         return 0;
     }
-    _socket_keepalive(fd);
+#endif
+    if (!lis->packet && sa.ss_family != AF_UNIX)
+        _socket_keepalive(fd);
     struct socket *s = _create_socket(self, fd, lis->ud, SOCKET_PROTOCOL_TCP);
     if (s == NULL) {
         _socket_close(fd);
         return 0;
     }
-    if (_socket_nonblocking(fd) == -1 /*||
-        _socket_closeonexec(fd) == -1*/) {
-        _close_socket(self, s);
-        return 0;
-    }
+    s->packet = lis->packet;
     s->status = STATUS_CONNECTED;
 
     msg->id = sockid(s); 
@@ -697,7 +1971,12 @@ _accept(struct net *self, struct socket *lis, struct socket_message *msg) {
     char tmp[INET6_ADDRSTRLEN];
     const void *addr;
     uint16_t port;
-    if (sa.ss_family == AF_INET) {
+    if (sa.ss_family == AF_UNIX) {
+        // the client is unnamed mostly
+        msg->data = "unix:";
+        msg->size = 5;
+        return 1;
+    } else if (sa.ss_family == AF_INET) {
         struct sockaddr_in *s = (struct sockaddr_in *)&sa;
         addr = &s->sin_addr;
         port = s->sin_port;
@@ -717,8 +1996,78 @@ _accept(struct net *self, struct socket *lis, struct socket_message *msg) {
     return 1;
 }
 
-int
-socket_listen(struct net *self, const char *addr, int port, int ud) {    
+// backlog for the next listen, and max accepted for one listen event,
+// 0 for the default
+void
+socket_listenopt(struct net *self, int backlog, int batch) {
+    self->backlog = backlog > 0 ? backlog : LISTEN_BACKLOG;
+    self->accept_batch = batch > 0 ? batch : ACCEPT_BATCH;
+}
+
+// "unix:/path" for the stream, "unixpacket:/path" for the seqpacket,
+// the path start with '@' is in the linux abstract namespace,
+// return the socket type, 0 for not unix address, or -1 for error
+static int
+_unix_addr(const char *addr, struct sockaddr_un *su, socklen_t *len) {
+    int type;
+    if (strncmp(addr, "unix:", 5) == 0) {
+        type = SOCK_STREAM;
+        addr += 5;
+    } else if (strncmp(addr, "unixpacket:", 11) == 0) {
+        type = SOCK_SEQPACKET;
+        addr += 11;
+    } else return 0;
+    size_t n = strlen(addr);
+    if (n == 0 || n >= sizeof(su->sun_path))
+        return -1;
+    memset(su, 0, sizeof(*su));
+    su->sun_family = AF_UNIX;
+    memcpy(su->sun_path, addr, n);
+    if (addr[0] == '@')
+        su->sun_path[0] = '\0';
+    *len = offsetof(struct sockaddr_un, sun_path) + n;
+    return type;
+}
+
+// the path left by the dead listener, no one accept on it
+static int
+_unix_stale(struct sockaddr_un *su, socklen_t len, int type) {
+    socket_t fd = socket(AF_UNIX, type, 0);
+    if (fd == -1)
+        return 0;
+    int stale = 0;
+    if (_socket_nonblocking(fd) == 0 &&
+        connect(fd, (struct sockaddr*)su, len) == -1)
+        stale = _socket_geterror(fd) == ECONNREFUSED;
+    _socket_close(fd);
+    return stale;
+}
+
+static socket_t
+_bind_unix(struct sockaddr_un *su, socklen_t len, int type) {
+    socket_t fd = socket(AF_UNIX, type, 0);
+    if (fd == -1)
+        return -1;
+    if (_socket_nonblocking(fd) == -1 ||
+        _socket_closeonexec(fd) == -1) {
+        _socket_close(fd);
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr*)su, len) == -1) {
+        if (_socket_geterror(fd) != EADDRINUSE ||
+            su->sun_path[0] == '\0' ||
+            !_unix_stale(su, len, type) ||
+            unlink(su->sun_path) == -1 ||
+            bind(fd, (struct sockaddr*)su, len) == -1) {
+            _socket_close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static socket_t
+_bind_tcp(const char *addr, int port, int reuseport) {
     struct addrinfo hints;
     struct addrinfo *result, *rp;
     memset(&hints, 0, sizeof(hints));
@@ -738,8 +2087,10 @@ socket_listen(struct net *self, const char *addr, int port, int ud) {
             continue;
         if (_socket_nonblocking(fd) == -1 ||
             _socket_closeonexec(fd) == -1 ||
-            _socket_reuseaddr(fd)   == -1) {
+            _socket_reuseaddr(fd)   == -1 ||
+            (reuseport && _socket_reuseport(fd) == -1)) {
             _socket_close(fd);
+            freeaddrinfo(result);
             return -1;
         }
         if (bind(fd, rp->ai_addr, rp->ai_addrlen) == -1) {
@@ -750,10 +2101,28 @@ socket_listen(struct net *self, const char *addr, int port, int ud) {
         break;
     }
     freeaddrinfo(result);
+    return fd;
+}
+
+// reuseport, every process listen the same port by its own socket,
+// and the kernel balance the connection to them, the unix address
+// ignore the port, and can not reuseport
+int
+socket_listen(struct net *self, const char *addr, int port, int ud, int reuseport) {    
+    struct sockaddr_un su;
+    socklen_t len;
+    int type = _unix_addr(addr, &su, &len);
+    int fd;
+    if (type < 0 || (type > 0 && reuseport))
+        return -1;
+    if (type > 0)
+        fd = _bind_unix(&su, len, type);
+    else
+        fd = _bind_tcp(addr, port, reuseport);
     if (fd == -1) 
         return -1;
 
-    if (listen(fd, LISTEN_BACKLOG) == -1) {
+    if (listen(fd, self->backlog) == -1) {
         _socket_close(fd);
         return -1;
     }
@@ -763,11 +2132,12 @@ socket_listen(struct net *self, const char *addr, int port, int ud) {
         _socket_close(fd);
         return -1;
     }
+    s->packet = type == SOCK_SEQPACKET;
+    s->status = STATUS_LISTENING;
     if (_subscribe(self, s, NP_RABLE)) {
         _close_socket(self, s);
         return -1;
     }
-    s->status = STATUS_LISTENING;
     return sockid(s);
 }
 
@@ -782,8 +2152,8 @@ _onconnect(struct net *self, struct socket *s, struct socket_message *msg) {
     msg->id = sockid(s); 
     msg->ud = s->ud;
     if (err == 0) {
-        s->status = STATUS_CONNECTED;
         _subscribe(self, s, 0);
+        s->status = STATUS_CONNECTED;
         msg->type = SOCKET_TYPE_CONNECT;
     } else {
         _close_socket(self, s);
@@ -792,8 +2162,23 @@ _onconnect(struct net *self, struct socket *s, struct socket_message *msg) {
     return 1;
 }
 
-int
-socket_connect(struct net *self, const char *addr, int port, int block, int ud, int *conning) {
+// the unix connect never in progress, it fail if the backlog is full
+static socket_t
+_connect_unix(struct sockaddr_un *su, socklen_t len, int type, int *status) {
+    socket_t fd = socket(AF_UNIX, type, 0);
+    if (fd == -1)
+        return -1;
+    if (_socket_nonblocking(fd) == -1 ||
+        connect(fd, (struct sockaddr*)su, len) == -1) {
+        _socket_close(fd);
+        return -1;
+    }
+    *status = STATUS_CONNECTED;
+    return fd;
+}
+
+static socket_t
+_connect_tcp(const char *addr, int port, int block, int *status) {
     struct addrinfo hints;
     struct addrinfo *result, *rp;
     memset(&hints, 0, sizeof(hints));
@@ -806,7 +2191,7 @@ socket_connect(struct net *self, const char *addr, int port, int block, int ud,
     if (getaddrinfo(addr, sport, &hints, &result)) {
         return -1;
     }
-    int fd = -1, status;
+    int fd = -1;
     for (rp = result; rp != NULL; rp = rp->ai_next) {
         fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
         if (fd == -1)
@@ -833,9 +2218,9 @@ socket_connect(struct net *self, const char *addr, int port, int block, int ud,
                     continue;
                 }
             }
-            status = STATUS_CONNECTING;
+            *status = STATUS_CONNECTING;
         } else {
-            status = STATUS_CONNECTED;
+            *status = STATUS_CONNECTED;
         }
         if (block)
             if (_socket_nonblocking(fd) == -1) { // 仅connect阻塞
@@ -844,15 +2229,30 @@ socket_connect(struct net *self, const char *addr, int port, int block, int ud,
         break;
     }
     freeaddrinfo(result);
-    if (fd == -1)  {
+    return fd;
+}
+
+int
+socket_connect(struct net *self, const char *addr, int port, int block, int ud, int *conning) {
+    struct sockaddr_un su;
+    socklen_t len;
+    int type = _unix_addr(addr, &su, &len);
+    int fd, status;
+    if (type < 0)
+        return -1;
+    if (type > 0)
+        fd = _connect_unix(&su, len, type, &status);
+    else
+        fd = _connect_tcp(addr, port, block, &status);
+    if (fd == -1)
         return -1;
-    }
     struct socket *s;
     s = _create_socket(self, fd, ud, SOCKET_PROTOCOL_TCP);
     if (s == NULL) {
         _socket_close(fd);
         return -1;
     }
+    s->packet = type == SOCK_SEQPACKET;
     s->status = status;
     if (s->status == STATUS_CONNECTING) {
         if (_subscribe(self, s, NP_RABLE|NP_WABLE)) {
@@ -864,36 +2264,149 @@ socket_connect(struct net *self, const char *addr, int port, int block, int ud,
     return sockid(s);
 }
 
+// the ready socket to read again, the rest udp datagram, the blocked
+// socket to report, they are changed by the others, call it with the lock
 int
-socket_poll(struct net *self, int timeout, struct socket_message *msg, int *more) {
+socket_pending(struct net *self) {
+    return self->ready_count + self->notify_count +
+        self->udp->count - self->udp->index;
+}
+
+// return the event count wait to handle by socket_poll, and more by
+// socket_pending, no wait if more, it touch the events only, so it may
+// run without the lock
+int
+socket_wait(struct net *self, int timeout, int more) {
     if (self->event_index == self->event_count) {
-        int n = np_poll(&self->np, self->events, self->max, timeout);
+        // no wait if some socket read again
+        int n = np_poll(&self->np, self->events, self->batch,
+                more > 0 ? 0 : timeout);
         if (n > 0) {
             self->event_count = n;
             self->event_index = 0;
-        } else return 0;
+        } else if (more == 0)
+            return 0;
+    }
+    return self->event_count - self->event_index + more;
+}
+
+// update the time after socket_wait, and free the expired buffer of the
+// closed zerocopy socket, socket_wait may run without the lock the
+// others hold, this one must run with it
+void
+socket_tick(struct net *self) {
+    self->now = _socket_now();
+    if (self->zlinger)
+        _zerocopy_linger(self, self->now);
+}
+
+// the edge socket read again, in the ready list
+static int
+_poll_ready(struct net *self, struct socket_message *msg) {
+    struct socket *s = self->ready_head;
+    self->ready_head = s->ready_next;
+    if (self->ready_head == NULL)
+        self->ready_tail = NULL;
+    s->ready_next = NULL;
+    s->ready = 0;
+    self->ready_count--;
+    // closed, reused, or read off
+    if (s->status == STATUS_INVALID || !s->edge || !(s->mask & NP_RABLE))
+        return 0;
+    struct np_event event;
+    memset(&event, 0, sizeof(event));
+    event.ud = s;
+    event.read = true;
+    return _read(self, s, &event, msg);
+}
+
+// the socket blocked by the send, in the notify list
+static int
+_poll_blocked(struct net *self, struct socket_message *msg) {
+    struct socket *s = self->notify_head;
+    self->notify_head = s->notify_next;
+    if (self->notify_head == NULL)
+        self->notify_tail = NULL;
+    s->notify_next = NULL;
+    s->notify = 0;
+    self->notify_count--;
+    // closed, or writable already
+    if (s->status == STATUS_INVALID || !s->blocked)
+        return 0;
+    msg->id = sockid(s);
+    msg->ud = s->ud;
+    msg->type = SOCKET_TYPE_BLOCKED;
+    return 1;
+}
+
+// more set 1 if the event is kept for the next call, as the listen batch
+int
+socket_poll(struct net *self, int timeout, struct socket_message *msg, int *more) {
+    // the rest datagram of the udp batch
+    if (self->udp->index < self->udp->count)
+        return _udp_next(self, msg);
+    if (self->notify_head)
+        return _poll_blocked(self, msg);
+    if (self->event_index == self->event_count) {
+        if (self->ready_head == NULL) {
+            int n = socket_wait(self, timeout, socket_pending(self));
+            socket_tick(self);
+            if (n == 0)
+                return 0;
+        }
+        // the event first, then the ready socket
+        if (self->event_index == self->event_count)
+            return _poll_ready(self, msg);
     }
     struct np_event *event = &self->events[self->event_index++];
-    if (more &&
-        self->event_index == self->event_count)
-        *more = 0;
     struct socket *s = (struct socket *)event->ud;
     switch (s->status) {
     case STATUS_LISTENING: {
         struct socket *lis = s;
-        return _accept(self, lis, msg);
+        if (_accept(self, lis, event, msg)) {
+#ifndef NP_COMPLETION
+            // keep the event, accept again in the next call,
+            // until EAGAIN or the batch
+            if (++self->accepted < self->accept_batch) {
+                self->event_index--;
+                if (more)
+                    *more = 1;
+            } else
+                self->accepted = 0;
+#endif
+            return 1;
+        }
+        self->accepted = 0;
+        return 0;
         }
     case STATUS_CONNECTING:
         return _onconnect(self, s, msg);
     case STATUS_INVALID:
         return 0;
+    case STATUS_WAKEUP:
+        _wakeup_drain(self);
+        return 0;
+    case STATUS_TIMER: {
+        uint64_t expired;
+        while (_socket_read(s->fd, &expired, sizeof(expired)) > 0)
+            ;
+        return 0;
+        }
     default: 
         if (event->write) {
-            if (_send_buffer(self, s, msg))
+            if (_send_buffer(self, s, msg)) {
+                // keep the event to read in the next call
+                if (msg->type == SOCKET_TYPE_WRITABLE && event->read) {
+                    event->write = false;
+                    self->event_index--;
+                    if (more)
+                        *more = 1;
+                }
                 return 1;
+            }
         }
         if (event->read) {
-            if (_read(self, s, msg)) 
+            if (_read(self, s, event, msg)) 
                 return 1;
         }
         return 0;
@@ -905,3 +2418,83 @@ socket_fd(struct net *self, int id) {
     struct socket *s = _socket(self, id);
     return s ? s->fd : -1;
 }
+
+static void
+_stat(struct net *self, struct socket *s, uint64_t now, struct socket_stat *st) {
+    st->id = sockid(s);
+    st->fd = s->fd;
+    st->protocol = s->protocol;
+    st->rbytes = s->rbytes;
+    st->wbytes = s->wbytes;
+    st->rcount = s->rcount;
+    st->wcount = s->wcount;
+    st->sbuffersz = s->sbuffersz;
+    st->rpending = s->rpending;
+    st->age = now > s->ctime ? now - s->ctime : 0;
+    st->idle = now > s->atime ? now - s->atime : 0;
+    st->rate = 0;
+    st->zbytes = s->zbytes;
+    st->zcopied = s->zcopied;
+    st->rtt = -1;
+    st->rttvar = -1;
+    st->retrans = -1;
+}
+
+// the io stat of the socket, with the tcp info, return -1 if id invalid
+int
+socket_stat(struct net *self, int id, struct socket_stat *st) {
+    struct socket *s = _socket(self, id);
+    if (s == NULL)
+        return -1;
+    _stat(self, s, _socket_now(), st);
+    if (s->protocol == SOCKET_PROTOCOL_TCP &&
+        (s->status == STATUS_CONNECTED || s->status == STATUS_HALFCLOSE))
+        _socket_tcpinfo(s->fd, &st->rtt, &st->rttvar, &st->retrans);
+    return 0;
+}
+
+static inline uint64_t
+_top_key(struct socket_stat *st, int by) {
+    switch (by) {
+    case SOCKET_TOP_RATE: return st->rate;
+    case SOCKET_TOP_IDLE: return st->idle;
+    default: return st->sbuffersz;
+    }
+}
+
+// the top n sockets by SOCKET_TOP_*, the data socket only, return the
+// count, the rate is bytes per second since the last call, no tcp info
+int
+socket_top(struct net *self, int by, struct socket_stat *st, int n) {
+    uint64_t now = _socket_now();
+    uint64_t elapsed = now > self->top_time ? now - self->top_time : 1;
+    struct socket_stat tmp;
+    int count = 0;
+    int i, j;
+    self->top_time = now;
+    for (i=0; i<self->nsocket; ++i) {
+        struct socket *s = _slot(self, i);
+        if (s->status != STATUS_CONNECTED &&
+            s->status != STATUS_HALFCLOSE &&
+            s->status != STATUS_BIND)
+            continue;
+        _stat(self, s, now, &tmp);
+        uint64_t bytes = s->rbytes + s->wbytes;
+        tmp.rate = (bytes - s->mark) * 1000 / elapsed;
+        s->mark = bytes;
+        if (n <= 0)
+            continue;
+        uint64_t key = _top_key(&tmp, by);
+        if (count == n) {
+            if (key <= _top_key(&st[n-1], by))
+                continue;
+            count--;
+        }
+        // insert sorted by the key desc
+        for (j=count; j>0 && _top_key(&st[j-1], by) < key; --j)
+            st[j] = st[j-1];
+        st[j] = tmp;
+        count++;
+    }
+    return count;
+}
@@ -13,6 +13,12 @@
 #define SOCKET_TYPE_CONNERR 3 
 #define SOCKET_TYPE_SOCKERR 4
 #define SOCKET_TYPE_WRIDONECLOSE 5
+#define SOCKET_TYPE_UDP     6
+#define SOCKET_TYPE_BLOCKED 7 // send buffer up to the high watermark
+#define SOCKET_TYPE_WRITABLE 8 // send buffer drop to the low watermark
+
+// udp address, family(1) port(2) and ipv4(4) or ipv6(16)
+#define SOCKET_UDP_ADDRSZ 19
 
 struct socket_message {
     int id;         // socket id
@@ -21,21 +27,67 @@ struct socket_message {
     int listenid;   // for SOCKET_TYPE_ACCEPT
     void *data;     // data
     int size;       // data size
+    uint8_t udpaddr[SOCKET_UDP_ADDRSZ]; // for SOCKET_TYPE_UDP, the source
+};
+
+// the io stat of a socket, the time is in ms
+struct socket_stat {
+    int id;
+    int fd;
+    int protocol;
+    uint64_t rbytes;
+    uint64_t wbytes;
+    uint64_t rcount; // read call, or datagram for udp
+    uint64_t wcount;
+    int sbuffersz; // queued to send
+    int rpending; // read but not consumed, see socket_readlimit
+    uint64_t age;
+    uint64_t idle; // since the last read or write
+    uint64_t rate; // bytes per second, by socket_top only
+    uint64_t zbytes; // sent by zerocopy, see socket_zerocopy
+    uint64_t zcopied; // zerocopy send completed but copied by the kernel
+    int rtt; // tcp smoothed rtt in usec, by socket_stat only, -1 unknown
+    int rttvar;
+    int retrans; // tcp total retransmits
 };
 
+#define SOCKET_TOP_SBUFFER 0 // queued to send
+#define SOCKET_TOP_RATE    1 // read and write throughput
+#define SOCKET_TOP_IDLE    2
+
 struct net;
 struct net *net_create(int max);
 void net_free(struct net *self);
 
 int socket_bind(struct net *self, int fd, int ud, int protocol);
-int socket_listen(struct net *self, const char *addr, int port, int ud);
+int socket_listen(struct net *self, const char *addr, int port, int ud, int reuseport);
+void socket_listenopt(struct net *self, int backlog, int batch);
+int socket_udp(struct net *self, const char *addr, int port, int ud);
+int socket_udpconnect(struct net *self, int id, const char *addr, int port);
+int socket_udpsend(struct net *self, int id, const uint8_t *udpaddr, void *data, int sz);
+int socket_udpaddrsz(const uint8_t *udpaddr);
+int socket_udpaddr(const uint8_t *udpaddr, char *ip, int sz, int *port);
 int socket_connect(struct net *self, const char *addr, int port, int block, int ud, int *conning);
 int socket_udata(struct net *self, int id, int ud);
 int socket_close(struct net *self, int id, int force);
 int socket_enableread(struct net *self, int id, int read);
+int socket_pending(struct net *self);
+int socket_wait(struct net *self, int timeout, int more);
+void socket_tick(struct net *self);
 int socket_poll(struct net *self, int timeout, struct socket_message *msg, int *more);
+void socket_wakeup(struct net *self);
+int socket_settimer(struct net *self, uint64_t usec);
 int socket_send(struct net *self, int id, void *data, int sz);
 int socket_sendfd(struct net *self, int id, void *data, int sz, int fd);
+void socket_defer(struct net *self, int defer, int wakeup);
+int socket_edge(struct net *self, int edge);
+int socket_watermark(struct net *self, int id, int high, int low);
+int socket_readlimit(struct net *self, int id, int high, int low);
+int socket_zerocopy(struct net *self, int id, int threshold);
+int socket_consumed(struct net *self, int id, int size);
+int socket_flush(struct net *self, struct socket_message *msg);
 int socket_fd(struct net *self, int id);
+int socket_stat(struct net *self, int id, struct socket_stat *st);
+int socket_top(struct net *self, int by, struct socket_stat *st, int n);
 
 #endif
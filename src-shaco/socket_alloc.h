@@ -6,9 +6,14 @@ void *shaco_malloc(size_t size);
 void *shaco_realloc(void *ptr, size_t size);
 void *shaco_calloc(size_t nmemb, size_t size);
 void  shaco_free(void *ptr);
+// read buffer from the pool, see shaco_rbuf.h
+void *shaco_rbuf_alloc(int size);
+void  shaco_rbuf_free(void *p);
 #define malloc  shaco_malloc
 #define realloc shaco_realloc
 #define calloc  shaco_calloc
 #define free    shaco_free
+#define socket_rbuf_alloc shaco_rbuf_alloc
+#define socket_rbuf_free  shaco_rbuf_free
 
 #endif
@@ -2,6 +2,7 @@
 #define __socket_platform_h__
 
 // include
+#include <stdint.h>
 #ifdef WIN32                 
 #define WIN32_LEAN_AND_MEAN
 #ifndef _WIN32_WINNT 
@@ -13,11 +14,24 @@
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <netdb.h>
+#include <time.h>
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#endif
+#endif
+
+// send by MSG_ZEROCOPY, the completion is read from the error queue
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define SOCKET_ZEROCOPY
 #endif
 
 // socket type
@@ -46,6 +60,7 @@
 #define _socket_geterror(fd) errno
 #define _socket_write(fd, buf, sz) write(fd, buf, sz)
 #define _socket_read(fd, buf, sz)  read(fd, buf, sz)
+#define _socket_writev(fd, iov, n) writev(fd, iov, n)
 #else
 #define _socket_error WSAGetLastError()
 #define _socket_strerror(e) "socket error"
@@ -89,6 +104,65 @@ _socket_reuseaddr(socket_t fd) {
     return setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void*)&reuse, sizeof(reuse));
 }
 
+// the AF_INET6 socket accept v4 too (v4 mapped) if on is 0
+static inline int
+_socket_v6only(socket_t fd, int on) {
+    return setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (void*)&on, sizeof(on));
+}
+
+// -1 if the platform has no SO_REUSEPORT
+static inline int
+_socket_reuseport(socket_t fd) {
+#ifdef SO_REUSEPORT
+    int reuse = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void*)&reuse, sizeof(reuse));
+#else
+    return -1;
+#endif
+}
+
+// accept the nonblocking and close on exec fd, accept4 need _GNU_SOURCE
+static inline socket_t
+_socket_accept(socket_t fd, struct sockaddr *sa, socklen_t *l) {
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    return accept4(fd, sa, l, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
+    socket_t c = accept(fd, sa, l);
+    if (c >= 0 && 
+        (_socket_nonblocking(c) == -1 || _socket_closeonexec(c) == -1)) {
+        close(c);
+        return -1;
+    }
+    return c;
+#endif
+}
+
+// the monotonic time in ms
+static inline uint64_t
+_socket_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+// the tcp smoothed rtt and rttvar in usec, the total retransmits,
+// -1 if not supported
+static inline int
+_socket_tcpinfo(socket_t fd, int *rtt, int *rttvar, int *retrans) {
+#if defined(__linux__) && defined(TCP_INFO)
+    struct tcp_info ti;
+    socklen_t l = sizeof(ti);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, (void*)&ti, &l))
+        return -1;
+    *rtt = ti.tcpi_rtt;
+    *rttvar = ti.tcpi_rttvar;
+    *retrans = ti.tcpi_total_retrans;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 #else
 static inline int
 _socket_close(socket_t fd) {
@@ -113,6 +187,26 @@ _socket_reuseaddr(socket_t fd) {
     return 0;
 }
 
+static inline int
+_socket_reuseport(socket_t fd) {
+    return -1;
+}
+
+static inline int
+_socket_v6only(socket_t fd, int on) {
+    return setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&on, sizeof(on));
+}
+
+static inline socket_t
+_socket_accept(socket_t fd, struct sockaddr *sa, socklen_t *l) {
+    socket_t c = accept(fd, sa, l);
+    if (c != INVALID_SOCKET && _socket_nonblocking(c) == -1) {
+        closesocket(c);
+        return -1;
+    }
+    return c;
+}
+
 static inline int
 _socket_geterror(socket_t fd) {
     int optval;
@@ -127,6 +221,16 @@ _socket_geterror(socket_t fd) {
     return err;
 }
 
+static inline uint64_t
+_socket_now() {
+    return GetTickCount64();
+}
+
+static inline int
+_socket_tcpinfo(socket_t fd, int *rtt, int *rttvar, int *retrans) {
+    return -1;
+}
+
 #define inet_ntop(a,b,c,d)
 
 #endif
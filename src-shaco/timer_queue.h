@@ -0,0 +1,331 @@
+#ifndef __timer_queue_h__
+#define __timer_queue_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// timer queue backends: binary heap O(log n), hierarchical wheel O(1)
+// the time unit is tick (ms), both are not thread safe
+
+struct time_node {
+    struct time_node *next;   // wheel slot, or pool freelist
+    struct time_node **pprev; // wheel slot
+    int index;                // heap position
+    uint32_t slot;            // pool slot
+    uint32_t gen;             // bump when free, so the old id is dead
+    uint32_t handle;
+    int session;
+    int repeat;
+    uint64_t interval;
+    uint64_t expire;
+};
+
+// id = gen<<32 | slot, never be 0
+#define TIME_NODE_ID(n) ((uint64_t)(n)->gen << 32 | (n)->slot)
+
+// pool, every node own a slot for ever, so the id can find it
+struct time_pool {
+    int cap;
+    int sz;
+    struct time_node **slots;
+    struct time_node *freelist;
+};
+
+static inline struct time_node *
+time_node_alloc(struct time_pool *p) {
+    struct time_node *n = p->freelist;
+    if (n) {
+        p->freelist = n->next;
+        return n;
+    }
+    if (p->sz == p->cap) {
+        p->cap = p->cap ? p->cap*2 : 64;
+        p->slots = realloc(p->slots, sizeof(p->slots[0]) * p->cap);
+    }
+    n = malloc(sizeof(*n));
+    n->slot = p->sz;
+    n->gen = 1;
+    p->slots[p->sz++] = n;
+    return n;
+}
+
+static inline void
+time_node_free(struct time_pool *p, struct time_node *n) {
+    n->gen = (n->gen + 1) & 0x7fffffff;
+    if (n->gen == 0)
+        n->gen = 1;
+    n->next = p->freelist;
+    p->freelist = n;
+}
+
+// the node in queue, NULL if it is expired or no found
+static inline struct time_node *
+time_node_find(struct time_pool *p, uint64_t id) {
+    uint32_t slot = (uint32_t)id;
+    if (slot >= p->sz)
+        return NULL;
+    struct time_node *n = p->slots[slot];
+    return n->gen == (uint32_t)(id >> 32) ? n : NULL;
+}
+
+static inline void
+time_pool_fini(struct time_pool *p) {
+    int i;
+    for (i=0; i<p->sz; ++i)
+        free(p->slots[i]);
+    free(p->slots);
+    memset(p, 0, sizeof(*p));
+}
+
+// heap, keep the expire in the entry to compare without touch the node
+
+struct time_entry {
+    uint64_t expire;
+    struct time_node *n;
+};
+
+struct time_heap {
+    int cap;
+    int sz;
+    struct time_entry *p;
+};
+
+static inline void
+_heap_set(struct time_heap *h, int i, struct time_entry e) {
+    h->p[i] = e;
+    e.n->index = i;
+}
+
+static inline void
+_heap_up(struct time_heap *h, int pos, struct time_entry e) {
+    while (pos>0) {
+        int up = (pos-1)/2;
+        if (e.expire < h->p[up].expire)
+            _heap_set(h, pos, h->p[up]);
+        else break;
+        pos=up;
+    }
+    _heap_set(h, pos, e);
+}
+
+static inline void
+_heap_down(struct time_heap *h, int pos, struct time_entry e) {
+    int last = h->sz-1;
+    int child = pos*2+1;
+    while (child <= last) {
+        if (child < last)
+            if (h->p[child].expire > h->p[child+1].expire)
+                child++;
+        if (e.expire > h->p[child].expire)
+            _heap_set(h, pos, h->p[child]);
+        else break;
+        pos = child;
+        child = pos*2+1;
+    }
+    _heap_set(h, pos, e);
+}
+
+static inline void
+time_heap_push(struct time_heap *h, struct time_node *n) {
+    if (h->sz == h->cap) {
+        if (h->cap == 0)
+            h->cap = 1;
+        else
+            h->cap *= 2;
+        h->p = realloc(h->p, sizeof(h->p[0]) * h->cap);
+    }
+    struct time_entry e = { n->expire, n };
+    _heap_up(h, h->sz++, e);
+}
+
+static inline struct time_node *
+time_heap_top(struct time_heap *h) {
+    return h->sz > 0 ? h->p[0].n : NULL;
+}
+
+static inline void
+time_heap_remove(struct time_heap *h, struct time_node *n) {
+    int pos = n->index;
+    struct time_entry last = h->p[--h->sz];
+    if (last.n != n) {
+        if (pos > 0 && last.expire < h->p[(pos-1)/2].expire)
+            _heap_up(h, pos, last);
+        else
+            _heap_down(h, pos, last);
+    }
+}
+
+// the top node expired until now, or NULL
+static inline struct time_node *
+time_heap_pop(struct time_heap *h, uint64_t now) {
+    if (h->sz == 0 || h->p[0].expire > now)
+        return NULL;
+    struct time_node *n = h->p[0].n;
+    time_heap_remove(h, n);
+    return n;
+}
+
+static inline void
+time_heap_fini(struct time_heap *h) {
+    free(h->p);
+    memset(h, 0, sizeof(*h));
+}
+
+// wheel, 256 near slots then 4 levels of 64 slots, cover 2^32 ticks
+
+#define WHEEL_NEAR_SHIFT 8
+#define WHEEL_NEAR (1 << WHEEL_NEAR_SHIFT)
+#define WHEEL_NEAR_MASK (WHEEL_NEAR-1)
+#define WHEEL_LEVEL_SHIFT 6
+#define WHEEL_LEVEL (1 << WHEEL_LEVEL_SHIFT)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL-1)
+#define WHEEL_LEVELS 4
+
+struct time_wheel {
+    uint64_t time;
+    int count;
+    struct time_node *expired; // moved from near slot, pop one by one
+    struct time_node *near[WHEEL_NEAR];
+    struct time_node *level[WHEEL_LEVELS][WHEEL_LEVEL];
+};
+
+static inline void
+_wheel_link(struct time_node **head, struct time_node *n) {
+    n->next = *head;
+    if (n->next)
+        n->next->pprev = &n->next;
+    n->pprev = head;
+    *head = n;
+}
+
+static inline void
+_wheel_unlink(struct time_node *n) {
+    *n->pprev = n->next;
+    if (n->next)
+        n->next->pprev = n->pprev;
+}
+
+static inline void
+time_wheel_init(struct time_wheel *w, uint64_t now) {
+    memset(w, 0, sizeof(*w));
+    w->time = now;
+}
+
+static inline void
+_wheel_place(struct time_wheel *w, struct time_node *n) {
+    uint64_t expire = n->expire;
+    uint64_t time = w->time;
+    if (expire < time)
+        expire = time;
+    if ((expire|WHEEL_NEAR_MASK) == (time|WHEEL_NEAR_MASK)) {
+        _wheel_link(&w->near[expire & WHEEL_NEAR_MASK], n);
+        return;
+    }
+    uint64_t mask = (uint64_t)WHEEL_NEAR << WHEEL_LEVEL_SHIFT;
+    int i;
+    for (i=0; i<WHEEL_LEVELS-1; ++i) {
+        if ((expire|(mask-1)) == (time|(mask-1)))
+            break;
+        mask <<= WHEEL_LEVEL_SHIFT;
+    }
+    int shift = WHEEL_NEAR_SHIFT + i*WHEEL_LEVEL_SHIFT;
+    _wheel_link(&w->level[i][(expire >> shift) & WHEEL_LEVEL_MASK], n);
+}
+
+static inline void
+time_wheel_add(struct time_wheel *w, struct time_node *n) {
+    _wheel_place(w, n);
+    w->count++;
+}
+
+static inline void
+time_wheel_remove(struct time_wheel *w, struct time_node *n) {
+    _wheel_unlink(n);
+    w->count--;
+}
+
+// re-place all node of the slot
+static inline void
+_wheel_move(struct time_wheel *w, struct time_node **head) {
+    struct time_node *n = *head;
+    *head = NULL;
+    while (n) {
+        struct time_node *next = n->next;
+        _wheel_place(w, n);
+        n = next;
+    }
+}
+
+// re-place the upper level slot when the lower one turn around
+static inline void
+_wheel_cascade(struct time_wheel *w) {
+    uint64_t time = w->time >> WHEEL_NEAR_SHIFT;
+    uint64_t mask = WHEEL_NEAR;
+    int i = 0;
+    while ((w->time & (mask-1)) == 0 && i < WHEEL_LEVELS) {
+        int idx = time & WHEEL_LEVEL_MASK;
+        if (idx != 0 || i == WHEEL_LEVELS-1) {
+            _wheel_move(w, &w->level[i][idx]);
+            if (idx != 0)
+                break;
+        }
+        mask <<= WHEEL_LEVEL_SHIFT;
+        time >>= WHEEL_LEVEL_SHIFT;
+        ++i;
+    }
+}
+
+// move the near slot until now to expired
+static inline void
+_wheel_advance(struct time_wheel *w, uint64_t now) {
+    if (w->count == 0) {
+        // nothing to cascade, jump
+        if (now > w->time)
+            w->time = now;
+        return;
+    }
+    for (;;) {
+        struct time_node **head = &w->near[w->time & WHEEL_NEAR_MASK];
+        while (*head) {
+            struct time_node *n = *head;
+            _wheel_unlink(n);
+            _wheel_link(&w->expired, n);
+        }
+        if (w->time >= now)
+            break;
+        w->time++;
+        _wheel_cascade(w);
+    }
+}
+
+// one node expired until now, or NULL
+static inline struct time_node *
+time_wheel_pop(struct time_wheel *w, uint64_t now) {
+    if (w->expired == NULL)
+        _wheel_advance(w, now);
+    struct time_node *n = w->expired;
+    if (n)
+        time_wheel_remove(w, n);
+    return n;
+}
+
+// ticks to the next expire in the near slots, or to the next cascade,
+// -1 for no timer
+static inline int
+time_wheel_timeout(struct time_wheel *w, uint64_t now) {
+    if (w->count == 0)
+        return -1;
+    if (w->expired)
+        return 0;
+    int idx = w->time & WHEEL_NEAR_MASK;
+    int i;
+    for (i=idx; i<WHEEL_NEAR; ++i) {
+        if (w->near[i])
+            break;
+    }
+    uint64_t expire = w->time + (i-idx);
+    return expire > now ? (int)(expire-now) : 0;
+}
+
+#endif
@@ -0,0 +1,178 @@
+// mailbox benchmark: N producer threads push to one consumer,
+// compare the locked ring (the old mailbox) with the lock free mpsc queue
+// usage: mqbench [producer] [count per producer]
+#include "shaco_mpsc.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/time.h>
+
+struct message {
+    struct mpsc_node node;
+    int source;
+    int session;
+    int type;
+    int sz;
+    const void *msg;
+};
+
+static uint64_t
+_now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// locked ring, grow like the old Q
+struct ring {
+    pthread_mutex_t lock;
+    int cap;
+    int head;
+    int tail;
+    struct message *q;
+};
+
+static void
+ring_init(struct ring *r) {
+    pthread_mutex_init(&r->lock, NULL);
+    r->cap = 8;
+    r->head = 0;
+    r->tail = 0;
+    r->q = malloc(sizeof(r->q[0]) * r->cap);
+}
+
+static void
+ring_push(struct ring *r, struct message *m) {
+    pthread_mutex_lock(&r->lock);
+    r->q[r->tail] = *m;
+    if (++r->tail == r->cap)
+        r->tail = 0;
+    if (r->tail == r->head) {
+        int cap = r->cap;
+        r->cap *= 2;
+        r->q = realloc(r->q, sizeof(r->q[0]) * r->cap);
+        int i;
+        for (i=0; i<r->tail; ++i)
+            r->q[cap+i] = r->q[i];
+        r->tail = cap+r->tail;
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+static int
+ring_pop(struct ring *r, struct message *m) {
+    int ret = 1;
+    pthread_mutex_lock(&r->lock);
+    if (r->head != r->tail) {
+        *m = r->q[r->head];
+        if (++r->head == r->cap)
+            r->head = 0;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+static struct ring R;
+static struct mpsc_queue Q;
+static int COUNT;
+static int START;
+
+static void
+_wait_start() {
+    while (!__atomic_load_n(&START, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+static void *
+_ring_producer(void *ud) {
+    struct message m;
+    memset(&m, 0, sizeof(m));
+    m.source = (int)(intptr_t)ud;
+    // payload is malloc per message, same as the mailbox do
+    _wait_start();
+    int i;
+    for (i=0; i<COUNT; ++i) {
+        m.session = i;
+        m.msg = malloc(16);
+        ring_push(&R, &m);
+    }
+    return NULL;
+}
+
+static void *
+_mpsc_producer(void *ud) {
+    int source = (int)(intptr_t)ud;
+    _wait_start();
+    int i;
+    for (i=0; i<COUNT; ++i) {
+        // payload inline with the node
+        struct message *m = malloc(sizeof(*m) + 16);
+        m->source = source;
+        m->session = i;
+        m->msg = m+1;
+        mpsc_push(&Q, &m->node);
+    }
+    return NULL;
+}
+
+static double
+_run(const char *name, int nproducer, void *(*producer)(void*), int mpsc) {
+    pthread_t *threads = malloc(sizeof(threads[0]) * nproducer);
+    int i;
+    START = 0;
+    for (i=0; i<nproducer; ++i) {
+        pthread_create(&threads[i], NULL, producer, (void*)(intptr_t)i);
+    }
+    long long total = (long long)nproducer * COUNT;
+    long long n = 0;
+    uint64_t t1 = _now();
+    __atomic_store_n(&START, 1, __ATOMIC_RELEASE);
+    while (n < total) {
+        if (mpsc) {
+            struct message *m = (struct message *)mpsc_pop(&Q);
+            if (m) {
+                free(m);
+                n++;
+            }
+        } else {
+            struct message m;
+            if (ring_pop(&R, &m) == 0) {
+                free((void*)m.msg);
+                n++;
+            }
+        }
+    }
+    uint64_t t2 = _now();
+    for (i=0; i<nproducer; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    double elapsed = (t2-t1)/1000.0;
+    double rate = total / ((t2-t1)/1000000.0);
+    printf("%-6s producer=%d messages=%lld elapsed=%.1fms %.2fM msg/s\n",
+            name, nproducer, total, elapsed, rate/1000000);
+    return rate;
+}
+
+int
+main(int argc, char *argv[]) {
+    int nproducer = argc > 1 ? atoi(argv[1]) : 4;
+    COUNT = argc > 2 ? atoi(argv[2]) : 1000000;
+    if (nproducer <= 0 || COUNT <= 0) {
+        fprintf(stderr, "usage: %s [producer] [count per producer]\n", argv[0]);
+        return 1;
+    }
+    ring_init(&R);
+    mpsc_init(&Q);
+    int p;
+    for (p=1; p<=nproducer; p*=2) {
+        double r1 = _run("ring", p, _ring_producer, 0);
+        double r2 = _run("mpsc", p, _mpsc_producer, 1);
+        printf("       speedup %.2fx\n", r2/r1);
+    }
+    free(R.q);
+    return 0;
+}
@@ -0,0 +1,117 @@
+// timer queue benchmark: add N timers with random interval, then step the
+// time tick by tick until all expired, compare the heap with the wheel
+// usage: timerbench [max interval(ms)]
+#include "timer_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static uint64_t
+_now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int *
+_intervals(int n, int span) {
+    int *p = malloc(sizeof(p[0]) * n);
+    int i;
+    srand(n);
+    for (i=0; i<n; ++i) {
+        p[i] = 1 + rand() % span;
+    }
+    return p;
+}
+
+static struct time_pool P;
+
+static struct time_node *
+_node(uint64_t now, int interval) {
+    struct time_node *n = time_node_alloc(&P);
+    n->handle = 0;
+    n->session = 0;
+    n->interval = interval;
+    n->expire = now + interval;
+    return n;
+}
+
+// return the late fire count, should be 0
+static int
+_heap(const int *intervals, int n, uint64_t *add, uint64_t *expire) {
+    struct time_heap h;
+    struct time_node *node;
+    uint64_t now = 1000;
+    int i, late = 0;
+    memset(&h, 0, sizeof(h));
+    uint64_t t1 = _now();
+    for (i=0; i<n; ++i) {
+        time_heap_push(&h, _node(now, intervals[i]));
+    }
+    uint64_t t2 = _now();
+    while (h.sz > 0) {
+        now++;
+        while ((node = time_heap_pop(&h, now))) {
+            if (node->expire != now)
+                late++;
+            time_node_free(&P, node);
+        }
+    }
+    uint64_t t3 = _now();
+    time_heap_fini(&h);
+    *add = t2-t1;
+    *expire = t3-t2;
+    return late;
+}
+
+static int
+_wheel(const int *intervals, int n, uint64_t *add, uint64_t *expire) {
+    static struct time_wheel w;
+    struct time_node *node;
+    uint64_t now = 1000;
+    int i, late = 0;
+    time_wheel_init(&w, now);
+    uint64_t t1 = _now();
+    for (i=0; i<n; ++i) {
+        time_wheel_add(&w, _node(now, intervals[i]));
+    }
+    uint64_t t2 = _now();
+    while (w.count > 0) {
+        now++;
+        while ((node = time_wheel_pop(&w, now))) {
+            if (node->expire != now)
+                late++;
+            time_node_free(&P, node);
+        }
+    }
+    uint64_t t3 = _now();
+    *add = t2-t1;
+    *expire = t3-t2;
+    return late;
+}
+
+int
+main(int argc, char *argv[]) {
+    int span = argc > 1 ? atoi(argv[1]) : 60000;
+    if (span <= 0) {
+        fprintf(stderr, "usage: %s [max interval(ms)]\n", argv[0]);
+        return 1;
+    }
+    static const int counts[] = { 10000, 100000, 1000000 };
+    int i;
+    for (i=0; i<sizeof(counts)/sizeof(counts[0]); ++i) {
+        int n = counts[i];
+        int *intervals = _intervals(n, span);
+        uint64_t ha, he, wa, we;
+        int hl = _heap(intervals, n, &ha, &he);
+        int wl = _wheel(intervals, n, &wa, &we);
+        printf("timers=%-7d heap  add=%.1fms expire=%.1fms late=%d\n",
+                n, ha/1000.0, he/1000.0, hl);
+        printf("timers=%-7d wheel add=%.1fms expire=%.1fms late=%d\n",
+                n, wa/1000.0, we/1000.0, wl);
+        printf("              speedup %.2fx\n", (double)(ha+he)/(wa+we));
+        free(intervals);
+    }
+    time_pool_fini(&P);
+    return 0;
+}